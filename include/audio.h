@@ -1,35 +1,9 @@
 #ifndef AUDIO_H
 #define AUDIO_H
 
-#include <atomic>
-#include <vector>
-#include <random>
-
 #include "portaudio.h"
 
-#include "filemanager.h"
-#include "granular.h"
-
-// Struct that contains all audio objects used in the program for easy access
-struct AudioEngine {
-    int sampleRate;
-    AudioFileData audioData;
-
-    GranularEngine granEng;
-    std::atomic<bool> granularPlaying{false};
-    bool loop;
-    float start; //defines lower playback bound
-    float end; //defines upper playback bound
-    
-    // room for more objects
-
-    std::atomic<float> masterVolume; // Master volume
-
-    // Constructor, please specify sample rate
-    AudioEngine(const int sr, AudioFileData aData, float vol = 1.0f);
-    
-    void processAudio(float& l, float& r);
-};
+#include "engine.h"
 
 // Handles PortAudio initialization
 class ScopedPaHandler
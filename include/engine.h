@@ -0,0 +1,132 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <mutex>
+
+#include "filemanager.h"
+#include "granular.h"
+#include "lockfree.h"
+#include "voices.h"
+#include "workers.h"
+#include "profiler.h"
+
+// Parameters controlled from the GUI
+struct AudioParams {
+    GranularParams granular;
+    bool loop = false;
+    float start = 0.0f; //defines lower playback bound
+    float end = 1.0f; //defines upper playback bound
+    float volume = 1.0f; // Master volume
+    float crossfade = 0.05f; // seconds grains of a replaced sample fade out over, 0 cuts them off
+    float attack = 0.01f; // seconds for a voice to fade in
+    float release = 0.2f; // seconds for a voice to fade out after note off
+};
+
+// Struct that contains all audio objects used in the program for easy access
+struct AudioEngine {
+    int sampleRate;
+
+    GranularEngine granEng; // the transport, driven by play and stop
+    std::atomic<bool> granularPlaying{false};
+    VoiceManager voices; // notes, audio thread only
+    
+    // room for more objects
+
+    // GUI thread copy of the parameters, call publishParams() to hand them 
+    // to the audio thread
+    AudioParams params;
+    // Set by the GUI to move playback back to the start point
+    std::atomic<bool> rewind{false};
+    // Playback index as of the last block, for display
+    std::atomic<long long> playIndex{0};
+    // Voices sounding as of the last block, for display
+    std::atomic<int> voicesPlaying{0};
+    // Transport triggers lost to a full pool, to pages still loading and to
+    // reads longer than a page as of the last block, for display. The pool's
+    // own counts belong to the thread rendering it
+    std::atomic<int> grainsDropped{0}, grainsMissed{0}, grainsTooLong{0};
+    // Frames rendered since the engine was created, the clock notes are 
+    // timed against
+    std::atomic<long long> framesRendered{0};
+    // Sample swaps that cut the fade out short because every buffer slot was
+    // still in use, for display
+    std::atomic<int> fadesCut{0};
+    // Timing of the blocks, kept by whatever calls processBlock
+    Profiler profiler;
+    // Grains the transport starts and how far they played, for the GUI to
+    // draw playheads from. Events are dropped while nobody reads them
+    GrainEventQueue grainEvents;
+
+    // Constructor, please specify sample rate. poolSize is the number of 
+    // grains that can play at once per voice. Notes play on nVoices voices
+    // besides the transport, rendered in parallel on nWorkers threads plus
+    // the audio thread, -1 picks one per spare core
+    AudioEngine(const int sr, float vol = 1.0f, int poolSize = GRAIN_POOL_SIZE,
+        int nVoices = MAX_VOICES, int nWorkers = -1);
+    
+    // Renders a block of interleaved stereo frames into out
+    void processBlock(float* out, unsigned long nFrames);
+
+    // Sends a snapshot of params to the audio thread, picked up at the next block
+    void publishParams();
+
+    // Queues a note for the audio thread, velocity 0 releases it. The note
+    // starts exactly at frame (of framesRendered), or at the start of the 
+    // next block if that is already past. Notes must be sent in time order
+    // from a single thread. Returns false if the queue is full
+    bool sendNote(int note, float velocity, long long frame = 0);
+
+    // Hands new audio data to the audio thread, which switches to it at the
+    // next block. Callable from any thread except the audio thread
+    void loadSample(std::shared_ptr<const AudioFileData> data);
+
+    // Audio data most recently loaded, for display
+    std::shared_ptr<const AudioFileData> sample();
+
+    // Frees audio data the audio thread has stopped reading, call regularly
+    // from the main thread
+    void collectSamples();
+
+private:
+    // Loaded audio data is immutable and shared. Every buffer published to 
+    // the audio thread stays owned by inFlight until the audio thread sends
+    // it back through retired, so the audio thread never frees memory
+    std::mutex sampleMutex; // never locked by the audio thread
+    std::shared_ptr<const AudioFileData> latest;
+    std::vector<std::shared_ptr<const AudioFileData>> inFlight;
+    std::atomic<const AudioFileData*> pending{nullptr};
+    SpscQueue<const AudioFileData*, 16> retired;
+    // Audio thread side: buffers waiting for room in retired
+    const AudioFileData* retireBacklog[4] = {};
+    int retireBacklogSize = 0;
+    void retire(const AudioFileData* data);
+    void release(const AudioFileData* data); // with sampleMutex held
+
+    // Audio thread side: engines still reading each buffer, a buffer is 
+    // retired once every engine let go of it. Engines hold at most the
+    // current buffer and the one fading out, should every slot still be
+    // taken at a swap the fades are cut rather than next going untracked
+    struct SampleUse {
+        const AudioFileData* data;
+        int engines;
+    };
+    SampleUse sampleUses[4] = {};
+    void dropSample(const AudioFileData* data);
+    void collectReleased(GranularEngine& engine);
+
+    TripleBuffer<AudioParams> paramBuffer;
+    AudioParams live; // audio thread copy of the latest published params
+    float volume; // smoothed master volume
+
+    SpscQueue<NoteEvent, 256> notes;
+    WorkerPool workers;
+    // Chunk being rendered by the workers
+    float* chunkOut = nullptr;
+    int chunkFrames = 0;
+    static void renderJob(void* engine, int job);
+};
+
+#endif // ENGINE_H
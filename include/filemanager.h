@@ -3,23 +3,122 @@
 
 #include <vector>
 #include <string>
+#include <atomic>
+#include <memory>
+#include <functional>
 
-// Stores audio data from file
+#include "pages.h"
+#include "pcmcache.h"
+#include "storage.h"
+#include "peaks.h"
+#include "resampler.h"
+
+// Silent frames stored before and after the audio so interpolation taps
+// around any valid frame can be read without bounds checks
+#define GUARD_FRAMES (4)
+
+// Frames decoded between two updates of the ready watermark while loading
+#define DECODE_CHUNK_FRAMES (16384)
+// Shortest range of a file decoded on a thread of its own
+#define DECODE_MIN_RANGE_FRAMES (1 << 20)
+
+// Files that would take more memory than this once decoded stream from disk
+// through a page cache of this size instead, see FileManager::memoryBudget.
+// Compact storage formats take half as much, so twice as long files fit
+#define SAMPLE_MEMORY_BUDGET (1LL << 30)
+
+// Stores audio data from file. Move-only, a sample can be hundreds of MB and
+// is decoded straight into its buffer, so copies are never made by accident.
+// The buffer is sized for the whole file up front and fills in while the
+// sample already plays, frames below ready() can be read from any thread.
+// Files over the memory budget are paged instead: samples is the arena of a
+// PageStore and grains find their frames through pages. Samples can be kept
+// as 16-bit integers or half floats in compact, the render kernels convert
+// them as they read
 struct AudioFileData {
-    std::vector<float> samples;
+    std::vector<float> samples; // interleaved, padded with GUARD_FRAMES on both ends
+    std::vector<int16_t> compact; // same layout as samples for S16 and F16 storage
+    int storage; // a SampleStorage, always F32 for paged files
     int nChannels, sampleRate;
-    size_t size;
-    int frames;
-    AudioFileData(std::vector<float> samplesVec = {}, int numChannels = 1, int sRate = 44100);
+    size_t size; // number of samples, excluding guard frames
+    long long frames; // length of the file, see ready() for how much is decoded
+    std::unique_ptr<PageStore> pages; // null when the whole file is in samples
+    // Cached PCM in place of samples, see PcmCache
+    std::unique_ptr<PcmCache::MappedFile> mapped;
+    // Waveform peaks, built while the file loads, null if not wanted
+    std::unique_ptr<PeakPyramid> peaks;
+
+    // Silent buffer for numFrames frames, filled in place through raw(), or
+    // an arena of pageSlots float pages for a paged file
+    AudioFileData(long long numFrames = 0, int numChannels = 1, int sRate = 44100, 
+        int sampleStorage = SAMPLE_F32, int pageSlots = 0);
+    // Audio read straight from a mapped cache entry
+    AudioFileData(std::unique_ptr<PcmCache::MappedFile> mappedFile);
+    AudioFileData(const AudioFileData&) = delete;
+    AudioFileData& operator=(const AudioFileData&) = delete;
+    AudioFileData(AudioFileData&& other) noexcept;
+    AudioFileData& operator=(AudioFileData&& other) noexcept;
+
+    // Frames decoded so far, the writes to them are visible once this is read
+    inline long long ready() const { return framesReady.load(std::memory_order_acquire); }
+    // Publishes the frames written up to numFrames to the readers
+    inline void setReady(long long numFrames) { framesReady.store(numFrames, std::memory_order_release); }
+
+    // Pointer to the first sample of the first frame, in the storage format
+    inline const void* raw() const {
+        const char* base = mapped ? static_cast<const char*>(mapped->samples())
+            : storage == SAMPLE_F32 ? reinterpret_cast<const char*>(samples.data())
+            : reinterpret_cast<const char*>(compact.data());
+        return base + GUARD_FRAMES * nChannels * Storage::bytes(storage);
+    }
+    // Only for buffers being decoded into, never mapped ones
+    inline void* raw() { return const_cast<void*>(static_cast<const AudioFileData*>(this)->raw()); }
+    // raw() of float samples
+    inline const float* data() const { return static_cast<const float*>(raw()); }
+    inline float* data() { return static_cast<float*>(raw()); }
+
+    // Sample i counted from the first sample of the first frame, as a float
+    inline float sample(size_t i) const {
+        if (storage == SAMPLE_S16)
+            return Storage::fromS16(static_cast<const int16_t*>(raw())[i]);
+        if (storage == SAMPLE_F16)
+            return Storage::fromF16(static_cast<const uint16_t*>(raw())[i]);
+        return data()[i];
+    }
+
+private:
+    std::atomic<long long> framesReady{0};
 };
 
 namespace FileManager {
-    inline bool fileLoaded = false;
-    inline bool loading = false;
+    // set from the loader thread, read by the GUI
+    inline std::atomic<bool> fileLoaded{false};
+    inline std::atomic<bool> loading{false};
     inline std::string currentFileName;
+    // Decoded size in bytes past which files are paged, set before loading
+    inline long long memoryBudget = SAMPLE_MEMORY_BUDGET;
+    // Storage of the files dropped next, set from the GUI
+    inline int sampleStorage = SAMPLE_F32;
+    // Set before loading, tools that draw no waveform turn it off
+    inline bool buildPeaks = true;
+
+    // Called from the loader thread with the sample once its first chunk is
+    // decoded, the rest of the file keeps decoding into it
+    typedef std::function<void(std::shared_ptr<const AudioFileData>)> SampleStartCallback;
 
-    // Extract audio data from file and store it in an AudioFileData struct
-    AudioFileData LoadAudioFile(std::string filename);
+    // Extract audio data from file in chunks of DECODE_CHUNK_FRAMES. Returns
+    // the sample once fully decoded, or nullptr if nothing could be decoded.
+    // WAV and FLAC files over the memory budget are paged and returned as
+    // soon as their first pages are in. Decoded FLAC and MP3 files are kept
+    // in the PCM cache and mapped from it the next time. Samples are stored
+    // as storage, a SampleStorage, unless the file is paged. Returns once the
+    // waveform peaks are built as well, which for paged files takes a pass
+    // over the whole file. Peaks are cached for every format, a file seen
+    // before has its whole waveform from the start. Files at another sample
+    // rate than rate are converted to it as they decode, paged ones as their
+    // pages load. A rate of 0 keeps the rate of the file
+    std::shared_ptr<const AudioFileData> LoadAudioFile(std::string filename, 
+        const SampleStartCallback& onStart = {}, int storage = SAMPLE_F32, int rate = 0);
 }
 
 
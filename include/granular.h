@@ -2,56 +2,237 @@
 #define GRANULAR_H
 
 #include <vector>
-#include <random>
+#include <algorithm>
+#include <cmath>
 
 #include "filemanager.h"
+#include "window.h"
+#include "lockfree.h"
+#include "random.h"
 
-#define MAX_GRAINS (20)
+// Default number of grains that can play at once
+#define GRAIN_POOL_SIZE (4096)
+// Highest number of trigger slots per synthesis hop
+#define MAX_DENSITY (64)
 
-// Stereo grain with dynamic envelope
-class Grain {
-private:
-    AudioFileData* data;
-    int start, size; // size could be a percentage of Hs
-    float index, interval, pan, envelope;
-public:
-    bool isPlaying;
+// Fraction of the distance to their target that continuous parameters cover
+// each block, about a 20 ms time constant with 256 frame blocks at 44.1 kHz
+#define PARAM_SMOOTHING (0.25f)
 
-    Grain(AudioFileData* audioSamples = nullptr) ;
+// Number of grains the render kernels process at once, grain pools are 
+// padded to a multiple of it
+#define GRAIN_LANES (8)
 
-    void outputStereo(float& l, float& r);
+// Largest chunk the fade out of a replaced sample is rendered in
+#define FADE_CHUNK_FRAMES (256)
 
-    void trigger(int grainStart, int grainLength, float grainPan, float pitch, bool reverse);
+// Randomizer values drawn at once, refilled as triggers use them up
+#define RANDOM_BLOCK (256)
 
-    // Return values from audio data around point n necessary for interpolation
-    std::vector<float> get4Points(int n);
+// Capacity of a grain event stream, a few GUI frames of triggers at the
+// highest density
+#define GRAIN_EVENTS (4096)
 
-    // Returns current index relative to the inputted audio samples
-    inline int getCurrentRelIndex() { return index + start; };
+// Stereo grains with table windows, stored as a structure of arrays so the
+// render kernels can process GRAIN_LANES grains at once. Playing grains are
+// kept packed in [0, active): a new grain takes the first free slot and a 
+// finished one is replaced by the last, so the kernels only visit live grains
+struct GrainPool {
+    const AudioFileData* data;
+    int capacity; // multiple of GRAIN_LANES
+    int active = 0; // number of playing grains
+    int dropped = 0; // triggers lost because the pool was full
+    int missed = 0; // triggers lost because their page was not resident
+    int tooLong = 0; // triggers lost because they read more than a page holds
+    // Per grain state, playing is 0 or -1 (all bits set) to be usable as a
+    // SIMD lane mask
+    std::vector<int> start, playing;
+    std::vector<int> remaining; // frames left to play
+    std::vector<int> window; // offset of the window table, see Window::offset
+    std::vector<uint32_t> phase, phaseInc; // fixed point window phase
+    std::vector<int> played; // frames played so far
+    // Frame played i frames in is read origin + i * interval frames after
+    // start, kept within [0, span]
+    std::vector<float> origin, span, interval, pan;
 
-    inline float getEnvelope() {
-        return isPlaying ? envelope : 0;
-    }
+    GrainPool(int numGrains = GRAIN_POOL_SIZE, const AudioFileData* audioData = nullptr);
+
+    // Starts a new grain, returns false if the pool is full or the grain the audio data
+    // would read outside the audio data. position is the fractional frame the
+    // grain starts reading at, elapsed the part of a frame the grain already 
+    // played when its first frame is rendered, for onsets between frames
+    bool trigger(double position, int grainLength, float grainPan, float pitch, bool reverse, int shape = WINDOW_HANN, float elapsed = 0.0f);
+
+    // Adds nFrames of output of the playing grains to an interleaved stereo
+    // buffer, then frees the grains that ended
+    void render(float* out, int nFrames);
+
+    // Stops every grain
+    void clear();
+
+    inline bool isPlaying(int i) { return playing[i] != 0; }
 };
     
+enum GrainEventType {
+    GRAIN_STARTED,  // a grain started playing
+    GRAIN_CLOCK,    // grains played up to time
+    GRAIN_STOPPED   // every grain stopped, the sample was replaced
+};
+
+// What the grains of an engine did, for visualizers and logging. Times are
+// in frames played by the engine's grains, which stand still while it is
+// not rendering. A grain plays length frames from the first whole frame at
+// or after time, i frames after time it reads source frame position + i * pitch,
+// or position + (length - i) * pitch if reverse
+struct GrainEvent {
+    double time; // fractional, grains start between frames
+    // Frame after the last one the grain plays
+    inline double end() const { return ceil(time) + length; }
+    double position; // source frame the grain starts reading at
+    int length; // frames
+    float pitch, pan;
+    uint8_t type, window;
+    bool reverse;
+};
+
+using GrainEventQueue = SpscQueue<GrainEvent, GRAIN_EVENTS>;
+
+// Next onset of a trigger stream, in fractional synthesis frames. In density
+// mode stream i fires once per Hs, i * Hs / density after the first, in rate
+// mode a single stream fires every sampleRate / rate frames
+struct TriggerEvent {
+    double time; // jittered onset
+    double nominal; // onset before jitter, sets the read position
+    int stream;
+};
+
+// Granular parameters as set from the GUI, the audio thread picks up a copy
+// once per block
+struct GranularParams {
+    int Ha = 3000, density = 2, semitones = 0, cents = 0, revprob = 0;
+    int window = WINDOW_HANN;
+    // Grains per second, replaces the density slots with evenly spaced 
+    // triggers when above 0
+    float rate = 0.0f;
+    // size ∈ [0,1), jitterAmount ∈ [0,1], randomPanAmt ∈ [0,1], 
+    float size = 0.6f, stretch = 2.0f, jitterAmount = 0.0f, randomPanAmt = 0.0f, spread = 0.0f;
+
+    // Synthesis hopsize
+    inline int Hs() const { return std::max(1, static_cast<int>(Ha * stretch)); }
+
+    // Pitch ratio from semitones and cents
+    inline float pitch() const {
+        return 1.0f / pow(2.0f, -semitones / 12.0f) * pow(2.0f, cents / 1200.0f);
+    }
+};
+
 class GranularEngine {
 private:
-    int jitOffset = 0;
-    std::mt19937 gen; // mersenne_twister_engine seeded with rd()
-    std::uniform_int_distribution<> distrib;
-    int audioSize;
+    Random random; // seeded from std::random_device unless seed() is called
+    // Uniform draws for the pan, spread and direction of the next triggers,
+    // every trigger takes three whether its randomizers are on or not
+    float draws[RANDOM_BLOCK];
+    int nextDraw = RANDOM_BLOCK;
+    inline float draw() {
+        if (nextDraw == RANDOM_BLOCK) {
+            random.uniform(draws, RANDOM_BLOCK);
+            nextDraw = 0;
+        }
+        return draws[nextDraw++];
+    }
+    long long audioFrames; // spread is a fraction of the file length
+
+    // Pending onsets, one per stream, as a min-heap on time. Capacity for
+    // MAX_DENSITY streams is reserved up front
+    std::vector<TriggerEvent> events;
+    double period = 0; // frames between onsets of a stream
+    double gridOrigin = 0; // nominal onset of the last stream 0 grain
+
+    inline double currentPeriod() const { 
+        return rate > 0 ? sampleRate / rate : Hs; 
+    }
+    inline int streams() const { return rate > 0 ? 1 : density; }
+    // Places the next onset of every stream on the grid anchored at 
+    // gridOrigin, at or after the current index
+    void schedule();
+    // Stretches pending onsets when the period changed
+    void retime();
+    // Starts the grain of the earliest event and schedules its successor
+    void fire();
+    // Starts a grain with random pan, spread and direction
+    void spawnGrain(double position, int grainLength, float elapsed);
+
+    // Pushes an event if there is a queue and room in it
+    inline void report(const GrainEvent& e) {
+        if (eventQueue)
+            eventQueue->push(e);
+    }
+
+    // Grains still playing the previous sample while it fades out
+    GrainPool fadeGrains;
+    int fadeFrames = 0, fadeLength = 0;
+    std::vector<float> fadeBuffer;
+    // Audio data no grain references anymore, handed out by takeReleased.
+    // A swap can drop both the fading and the current data at once
+    const AudioFileData* released[2] = {};
+    int nReleased = 0;
+    void renderFade(float* out, int nFrames);
 public:
-    std::vector<Grain> grains;
-    int index, Hs, Ha, density, semitones, cents, revprob;
-    // size ∈ [0,1), jitterAmount ∈ [0,1], randomPanAmt ∈ [0,1], 
-    float size, stretch, jitterAmount, randomPanAmt, spread, pitch;
+    GrainPool grains;
+    long long index; // synthesis frame, 64-bit so long stretched files can't overflow
+    int cursor = 0; // page cache cursor this engine publishes its position to
+    int sampleRate = 44100; // to convert rate to frames
+    long long clock = 0; // frames the grains played, the time of grain events
+    // Where grain starts and the clock are reported, once per processBlock,
+    // if set. The queue must be read by a single thread and written by 
+    // this engine only
+    GrainEventQueue* eventQueue = nullptr;
+    // Parameters in use, only touched by the audio thread. Continuous values
+    // glide towards target, the rest take effect at the next block
+    int Hs, Ha, density, revprob, window;
+    float size, stretch, jitterAmount, randomPanAmt, spread, pitch, rate;
+    GranularParams target;
+
+    GranularEngine(const AudioFileData* audioSamples = nullptr, const GranularParams& params = {}, int poolSize = GRAIN_POOL_SIZE);
+
+    // Reseeds the random generator, renders are repeatable for a given seed
+    inline void seed(unsigned int s) { 
+        random.seed(s);
+        nextDraw = RANDOM_BLOCK;
+    }
+
+    // Switches grains to new audio data and restarts from the beginning. 
+    // Grains playing the old data fade out over fadeOutFrames, or stop at once
+    // if it is 0. Never allocates or frees, call takeReleased to learn when 
+    // the old data is no longer used
+    void setSample(const AudioFileData* audioSamples, int fadeOutFrames = 0);
+
+    // Ends the fade out of the previous sample at once, for when nothing
+    // renders it. Its data goes to takeReleased
+    void stopFade();
+
+    // Returns audio data that stopped being read, one at a time, or nullptr
+    // once there is none left. Call after setSample and after every processBlock
+    const AudioFileData* takeReleased();
+
+    // Renders nFrames of interleaved stereo output, adding to out
+    void processBlock(float* out, int nFrames);
+
+    // Moves playback to newIndex, the trigger grid restarts there
+    void seek(long long newIndex);
 
-    GranularEngine(AudioFileData& audioSamples);
+    // Renders like processBlock while keeping playback between the start and
+    // end points (fractions of the audio data), wrapping around if loop is
+    // set. Returns false once playback reached the end point without looping
+    bool playRegion(float* out, int nFrames, float start, float end, bool loop);
 
-    void playback(float& l, float& r);
+    // Sets the parameters to move to, continuous values jump straight to 
+    // their target if jump is true
+    void setParameters(const GranularParams& params, bool jump = false);
 
-    // update parameters, to leave parameters the same input any number <=0
-    void updateParameters(float newSize = 0, float newStretch = 0, int newDensity = 0, int newHa = 0, int newSemitones = 25, int newCents = 101);
+    // Moves continuous parameters one block closer to their targets, called
+    // once per block before rendering
+    void smoothParameters();
 };
 
 #endif //GRANULAR_H
\ No newline at end of file
@@ -0,0 +1,21 @@
+// Grain rendering kernels, selected at runtime from the instruction sets the
+// CPU supports
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include "granular.h"
+
+namespace Kernels {
+    // Adds nFrames of output of grains [0, nGrains) of the pool to an 
+    // interleaved stereo buffer, nGrains must be a multiple of GRAIN_LANES.
+    // Grains that end during the block are marked as not playing
+    void renderGrains(GrainPool& pool, int nGrains, float* out, int nFrames);
+
+    // Name of the kernel in use: "avx2", "sse2" or "scalar"
+    const char* selected();
+
+    // Forces a kernel by name, returns false if the CPU doesn't support it
+    bool select(const char* name);
+}
+
+#endif // KERNELS_H
@@ -0,0 +1,79 @@
+// Wait-free structures for passing data between the GUI and audio threads
+#ifndef LOCKFREE_H
+#define LOCKFREE_H
+
+#include <atomic>
+
+// Single writer, single reader triple buffer. The writer publishes whole
+// values, the reader picks up the latest one without ever blocking either side
+template <typename T>
+class TripleBuffer {
+private:
+    static constexpr int INDEX = 3;
+    static constexpr int FRESH = 4; // set while the middle slot holds unread data
+    T slots[3];
+    std::atomic<int> middle{1};
+    int back = 0;  // writer owned
+    int front = 2; // reader owned
+public:
+    TripleBuffer(const T& initial = T()) : slots{initial, initial, initial} {}
+
+    // Writer side
+    void publish(const T& value) {
+        slots[back] = value;
+        back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    // Reader side, returns true if a new value was picked up
+    bool update() {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH))
+            return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+
+    // Reader side, latest value picked up by update()
+    const T& read() const { return slots[front]; }
+};
+
+// Single producer, single consumer bounded FIFO, N must be a power of two
+template <typename T, unsigned N>
+class SpscQueue {
+private:
+    static_assert((N & (N - 1)) == 0, "SpscQueue size must be a power of two");
+    T items[N];
+    alignas(64) std::atomic<unsigned> head{0}; // next item to pop, consumer owned
+    alignas(64) std::atomic<unsigned> tail{0}; // next free slot, producer owned
+public:
+    // Producer side, returns false if the queue is full
+    bool push(const T& item) {
+        unsigned t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == N)
+            return false;
+        items[t % N] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side, copies the oldest item without removing it, returns 
+    // false if the queue is empty
+    bool peek(T& item) const {
+        unsigned h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+        item = items[h % N];
+        return true;
+    }
+
+    // Consumer side, returns false if the queue is empty
+    bool pop(T& item) {
+        unsigned h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+        item = items[h % N];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+#endif // LOCKFREE_H
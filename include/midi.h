@@ -0,0 +1,21 @@
+// Standard MIDI File reading, for driving voices from .mid files
+#ifndef MIDI_H
+#define MIDI_H
+
+#include <vector>
+#include <string>
+
+namespace Midi {
+    // Note on, or note off when velocity is 0, on any channel
+    struct MidiNote {
+        double seconds;
+        int note;
+        float velocity; // [0,1]
+    };
+
+    // Reads the notes of a format 0 or 1 file, merged across tracks and 
+    // sorted by time with tempo changes applied. Returns false on error
+    bool LoadMidiFile(const std::string& filename, std::vector<MidiNote>& notes);
+}
+
+#endif // MIDI_H
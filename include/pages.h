@@ -0,0 +1,119 @@
+// Page cache streaming long files from disk, so a sample takes bounded memory
+// whatever its length
+#ifndef PAGES_H
+#define PAGES_H
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <semaphore>
+#include <mutex>
+#include <cstdint>
+
+// Frames between the starts of two pages
+#define PAGE_FRAMES (1 << 18)
+// Frames a page holds past the start of the next one, a grain reading at most
+// this many frames always fits in the page it starts in. The longest grain the
+// knobs allow, just under Ha 8000 stretched 10 times read two octaves and 100
+// cents up, reads about 339000. Grains MIDI notes pitch further may not fit
+#define PAGE_OVERLAP (1 << 19)
+#define PAGE_SPAN (PAGE_FRAMES + PAGE_OVERLAP)
+// Fewest slots a page cache has, whatever the memory budget
+#define MIN_PAGE_SLOTS (8)
+// Pages kept resident ahead of every cursor
+#define PREFETCH_PAGES (2)
+// Positions the prefetcher follows, two per engine (playhead and loop start)
+#define PAGE_CURSORS (64)
+// Recent misses the prefetcher loads on its next pass
+#define PAGE_MISSES (32)
+// Time between two prefetcher passes
+#define PREFETCH_INTERVAL_MS (2)
+
+// Random access to the decoded frames of a file, only used from one thread at
+// a time
+class PageSource {
+public:
+    virtual ~PageSource() = default;
+    // Decodes up to n frames starting at frame first into out, returns the
+    // number of frames read
+    virtual long long read(long long first, long long n, float* out) = 0;
+    // Same as read, as 16-bit integers
+    virtual long long readS16(long long first, long long n, int16_t* out) = 0;
+};
+
+// Fixed set of page slots in one arena, filled from a PageSource by a
+// prefetch thread following the cursors the engines publish. Grains pin the
+// page they read for as long as they play, the least recently wanted of the
+// unpinned pages is evicted when a slot is needed. Audio threads never block:
+// a grain whose page is not resident is skipped and the page is loaded for
+// the next ones
+class PageStore {
+public:
+    // Frames between the starts of two slots in the arena, the page and a
+    // guard of the neighbouring frames on both ends for interpolation
+    static const int SLOT_STRIDE;
+
+    // arena holds nSlots * SLOT_STRIDE frames
+    PageStore(std::unique_ptr<PageSource> source, float* arena, long long frames, int channels, int nSlots);
+    ~PageStore();
+
+    // Loads the pages at the start of the file, then starts the prefetcher
+    void start();
+
+    // Pins the page holding [frame, frame + span) and returns the arena frame
+    // of frame in slotFrame, or returns false if the page is not resident.
+    // span is at most PAGE_OVERLAP. Lock-free, called from audio threads
+    bool pin(long long frame, double span, int& slotFrame);
+    // Releases the pin of a grain reading from slotFrame
+    void unpin(int slotFrame);
+
+    // Offline renders wait for a missing page instead of skipping the grain,
+    // never set for realtime playback
+    inline void setBlocking(bool b) { blocking.store(b, std::memory_order_relaxed); }
+
+    // Publishes where engine id plays and where it loops back to
+    inline void setCursor(int id, long long frame, long long loopStart) {
+        id = id % (PAGE_CURSORS / 2) * 2;
+        cursors[id].store(frame, std::memory_order_relaxed);
+        cursors[id + 1].store(loopStart, std::memory_order_relaxed);
+    }
+
+    inline int slots() const { return nSlots; }
+    // Pages loaded so far, for display
+    inline long long loads() const { return loaded.load(std::memory_order_relaxed); }
+
+private:
+    std::unique_ptr<PageSource> source;
+    float* arena;
+    long long frames, nPages;
+    int channels, nSlots;
+
+    // Slot of each page, -1 when not resident
+    std::unique_ptr<std::atomic<int>[]> table;
+    // Per slot
+    std::unique_ptr<std::atomic<long long>[]> slotPage; // -1 when free
+    std::unique_ptr<std::atomic<int>[]> pins;
+    std::vector<long long> lastWanted; // prefetcher owned, pass of last use
+
+    std::atomic<long long> cursors[PAGE_CURSORS];
+    std::atomic<long long> misses[PAGE_MISSES];
+    std::atomic<unsigned> nextMiss{0};
+    std::atomic<long long> loaded{0};
+
+    std::atomic<bool> blocking{false};
+    // Held while loading pages, only ever taken by the audio side when blocking
+    std::mutex loadMutex;
+    long long pass = 0;
+    std::thread thread;
+    std::binary_semaphore wake{0}; // released to quit
+
+    void loop();
+    // Makes the wanted pages resident, most urgent first
+    void prefetch();
+    // Decodes page into a free or evicted slot, returns false if every slot
+    // is pinned or wanted in this pass
+    bool load(long long page);
+};
+
+#endif // PAGES_H
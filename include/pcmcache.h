@@ -0,0 +1,85 @@
+// On-disk cache of decoded PCM, memory-mapped as the sample buffer on later
+// loads of the same file, and of waveform peaks
+#ifndef PCMCACHE_H
+#define PCMCACHE_H
+
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+#include "peaks.h"
+
+// Total size of the cache files past which the least recently used are deleted
+#define PCM_CACHE_BYTES (4LL << 30)
+
+namespace PcmCache {
+    // Set before loading
+    inline bool enabled = true;
+    inline long long capacity = PCM_CACHE_BYTES;
+
+    // Layout of a cache file: this header, then the interleaved frames in the
+    // storage format, padded with silent guard frames on both ends, the same
+    // layout as AudioFileData::samples
+    struct Header {
+        char magic[8];
+        int32_t nChannels, sampleRate;
+        int64_t frames;
+        int32_t guardFrames;
+        int32_t storage; // a SampleStorage
+        char reserved[32]; // keeps the samples 64-byte aligned
+    };
+    static_assert(sizeof(Header) == 64);
+
+    // Layout of a peak file: this header, then the peaks of every level of a
+    // PeakPyramid, finest first
+    struct PeakHeader {
+        char magic[8];
+        int64_t frames;
+        int32_t nChannels, baseFrames;
+        int64_t count; // of peaks
+        char reserved[32];
+    };
+    static_assert(sizeof(PeakHeader) == 64);
+
+    // Read-only shared mapping of a cache file, processes loading the same
+    // file share its pages
+    class MappedFile {
+    public:
+        ~MappedFile();
+        inline const Header& header() const { return *static_cast<const Header*>(address); }
+        // First guard frame
+        inline const void* samples() const { return static_cast<const char*>(address) + sizeof(Header); }
+
+    private:
+        friend std::unique_ptr<MappedFile> Find(const std::string& filename, int guardFrames, int storage,
+            int rate);
+        void* address = nullptr;
+        size_t length = 0;
+    };
+
+    // Maps the cached PCM of a file if there is a valid entry for its current
+    // path, modification time, size, storage and the rate it was converted to
+    // as it loaded (0 if it kept its own), or returns nullptr. Faults the
+    // pages in so the audio thread doesn't
+    std::unique_ptr<MappedFile> Find(const std::string& filename, int guardFrames, int storage, 
+        int rate = 0);
+
+    // Writes the decoded PCM of a file to the cache, samples laid out as in
+    // Header, then trims the cache down to its capacity. rate is the one the
+    // file was loaded for, as passed to Find. Returns false if the entry 
+    // couldn't be written
+    bool Store(const std::string& filename, const void* samples, int storage, int nChannels, 
+        int sampleRate, long long frames, int guardFrames, int rate = 0);
+
+    // Restores the peaks of a file from its entry, keyed like the PCM ones
+    // whatever the storage and rate, if it has one matching the pyramid.
+    // Returns false on a miss
+    bool FindPeaks(const std::string& filename, PeakPyramid& peaks);
+
+    // Writes the peaks of a file once the pyramid is built. Returns false if
+    // the entry couldn't be written
+    bool StorePeaks(const std::string& filename, const PeakPyramid& peaks);
+}
+
+#endif // PCMCACHE_H
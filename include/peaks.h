@@ -0,0 +1,67 @@
+// Min/max peaks of a sample at every zoom level, for drawing its waveform in
+// time independent of its length
+#ifndef PEAKS_H
+#define PEAKS_H
+
+#include <vector>
+#include <atomic>
+#include <cfloat>
+
+// Frames per peak of the finest level, each level above halves the resolution
+#define PEAK_BASE_FRAMES (256)
+
+// Lowest and highest sample over a range of frames, across all channels
+struct Peak {
+    float min = FLT_MAX, max = -FLT_MAX;
+    inline void merge(const Peak& p) {
+        min = p.min < min ? p.min : min;
+        max = p.max > max ? p.max : max;
+    }
+    inline bool empty() const { return min > max; }
+};
+
+// Pyramid of peaks filled in file order while the sample loads, by one
+// thread, and read by any other. Peaks are only read once every frame they
+// cover has been added, so readers never see one being written
+class PeakPyramid {
+public:
+    PeakPyramid(long long frames, int channels);
+
+    // Adds the next n interleaved frames of the file
+    void add(const float* samples, long long n);
+
+    // Frames covered by final peaks, the peaks below it can be read
+    inline long long built() const { return framesBuilt.load(std::memory_order_acquire); }
+
+    // Peak over at least [first, last), clipped to built(). Coarse peaks
+    // are used where they fit, so a range costs a few reads at any length
+    Peak range(long long first, long long last) const;
+
+    inline long long frames() const { return totalFrames; }
+    inline int nChannels() const { return channels; }
+    inline int levels() const { return static_cast<int>(offsets.size()); }
+
+    // Every level one after another, finest first, for saving once built
+    inline const std::vector<Peak>& all() const { return peaks; }
+    // Replaces every peak with saved ones, before the pyramid is shared.
+    // Returns false if there are not as many as it holds
+    bool restore(std::vector<Peak>&& saved);
+
+private:
+    long long totalFrames;
+    int channels;
+    std::vector<Peak> peaks; // every level one after another, finest first
+    std::vector<long long> offsets, counts; // per level, into peaks
+
+    // Writer state
+    Peak pending;
+    long long added = 0;
+    std::atomic<long long> framesBuilt{0};
+
+    // Whether peak i of level covers only frames already built
+    inline bool isFinal(int level, long long i, long long builtFrames) const {
+        return builtFrames == totalFrames || (i + 1) * (PEAK_BASE_FRAMES * (1LL << level)) <= builtFrames;
+    }
+};
+
+#endif // PEAKS_H
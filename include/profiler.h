@@ -0,0 +1,66 @@
+// Timing of audio blocks against their deadline, recorded by the audio thread
+// and read by any other
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+// DSP load histogram, 1% per bucket, the last one takes everything above
+#define PROFILE_BUCKETS (201)
+// Weight of the newest block in the smoothed DSP load
+#define PROFILE_SMOOTHING (0.05f)
+
+// Single writer: the thread rendering the blocks calls begin() and end()
+// around each one. Counters are atomics updated without locks, readers get a
+// consistent enough picture for display from stats()
+class Profiler {
+public:
+    // Summary of the blocks timed since the last reset
+    struct Stats {
+        long long blocks, late; // late blocks took longer than their deadline
+        long long underflows, overflows; // reported by the audio device
+        float load; // smoothed DSP load, 1 is the whole deadline
+        float meanLoad, maxLoad;
+        float p50, p99, p999; // load percentiles, to the bucket
+        double maxMicroseconds;
+        double latencyMs; // of the output as reported by the device, 0 if unknown
+    };
+
+    // Writer side, around the processing of a block
+    inline void begin() {
+        if (resetRequested.exchange(false, std::memory_order_acquire))
+            clear();
+        started = std::chrono::steady_clock::now();
+    }
+    // nFrames at sampleRate is the deadline. Device flags and latency come
+    // from the audio callback, offline renders pass none
+    void end(unsigned long nFrames, int sampleRate, bool underflow = false, bool overflow = false,
+        double latencySeconds = 0.0);
+
+    // Reader side
+    Stats stats() const;
+    // Blocks in DSP load bucket b, b percent of the deadline
+    inline long long bucket(int b) const { return histogram[b].load(std::memory_order_relaxed); }
+    // Starts over at the next block
+    inline void reset() { resetRequested.store(true, std::memory_order_release); }
+    // Writes the stats and the histogram to a text file, returns false on error
+    bool dump(const std::string& path) const;
+
+private:
+    std::chrono::steady_clock::time_point started;
+    std::atomic<long long> histogram[PROFILE_BUCKETS] = {};
+    std::atomic<long long> blocks{0}, late{0}, underflows{0}, overflows{0};
+    std::atomic<long long> busyNs{0}, deadlineNs{0}, maxNs{0};
+    std::atomic<float> load{0.0f}, maxLoad{0.0f};
+    std::atomic<double> latency{0.0};
+    std::atomic<bool> resetRequested{false};
+
+    // Writer side
+    void clear();
+    // Load below which a fraction of the blocks fall
+    float percentile(long long total, double fraction) const;
+};
+
+#endif // PROFILER_H
@@ -0,0 +1,54 @@
+// Small, fast and seedable random numbers for the randomizers
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <cstdint>
+#include <cstddef>
+
+// xoshiro256++ (Blackman and Vigna): 32 bytes of state, a few cycles per
+// draw and no allocation, so it can be used from the audio thread. The same
+// seed always gives the same sequence. Not for cryptography
+class Random {
+private:
+    uint64_t s[4];
+
+    static inline uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+public:
+    Random(uint64_t seed = 0) { this->seed(seed); }
+
+    // Expands seed into the whole state with splitmix64, so nearby seeds give
+    // unrelated sequences
+    void seed(uint64_t seed);
+
+    inline uint64_t next() {
+        const uint64_t result = rotl(s[0] + s[3], 23) + s[0];
+        const uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+        return result;
+    }
+
+    // Uniform in [0, 1), every float of the form k / 2^24
+    inline float uniform() { return (next() >> 40) * 0x1p-24f; }
+    // Uniform in [0, 1), every double of the form k / 2^53
+    inline double uniformDouble() { return (next() >> 11) * 0x1p-53; }
+
+    // Standard normal, mean 0 and deviation 1, by the ziggurat method
+    float gaussian();
+
+    // n draws at once, for filling a block of values. Two from every output
+    // of the generator, so not the same sequence as n single draws
+    void uniform(float* out, size_t n);
+    void gaussian(float* out, size_t n);
+
+private:
+    // Normal draw from a layer of the ziggurat, u is the magnitude in the
+    // top bits of a 32-bit draw
+    float gaussian(uint32_t u, int layer, bool negative);
+};
+
+#endif // RANDOM_H
@@ -0,0 +1,87 @@
+// Sample rate conversion of decoded audio, as it is read
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include "pages.h"
+
+// Taps of the filter when converting up, converting down by a factor d takes
+// d times as many so the filter follows the lower cutoff. A multiple of 8
+#define RESAMPLE_TAPS (64)
+// Most filter phases kept, enough for any two of the usual rates from 8 to
+// 192 kHz. Rates whose ratio needs more, like 44100 to 44099, use the phase
+// just before the exact one
+#define RESAMPLE_MAX_PHASES (4096)
+// Attenuation past the Nyquist frequency of the lower rate, sets the shape of
+// the Kaiser window and the width of the transition band
+#define RESAMPLE_STOPBAND_DB (80.0)
+// Output frames computed per pass over the input window
+#define RESAMPLE_BLOCK_FRAMES (4096)
+
+// Polyphase windowed-sinc filter converting inRate to outRate. Output frame n
+// lies n * M / L input frames in, M / L being the ratio of the rates in lowest
+// terms. Its phase (n * M) mod L picks one set of taps. Immutable once built,
+// shared by every source converting between the same rates
+class Resampler {
+public:
+    Resampler(int inRate, int outRate);
+
+    // Frames a file of inFrames frames converts to
+    long long outFrames(long long inFrames) const;
+
+    // Input frame output frame n is centered on, and the taps to apply
+    // around it, from taps() / 2 - 1 frames before it to taps() / 2 after
+    inline long long center(long long n) const { return n * M / L; }
+    const float* coefficients(long long n) const;
+
+    inline int taps() const { return nTaps; }
+    // Input frames per output frame
+    inline double ratio() const { return 1.0 * M / L; }
+
+    // Sum of a[i] * b[i] for i in [0, n), n a multiple of 8. SIMD where the
+    // CPU supports it
+    static float dot(const float* a, const float* b, int n);
+
+private:
+    long long L, M;
+    int nPhases, nTaps;
+    std::vector<float> table; // nPhases rows of nTaps
+};
+
+// Reads a source at another sample rate. Keeps a window of the input in one
+// plane per channel, so every output sample is a single dot product with
+// contiguous taps. Sequential reads continue from the window, any other read
+// refills it from the input frames around its first frame
+class ResampledSource : public PageSource {
+public:
+    ResampledSource(std::unique_ptr<PageSource> input, std::shared_ptr<const Resampler> resampler,
+        long long inFrames, int channels);
+
+    long long read(long long first, long long n, float* out) override;
+    long long readS16(long long first, long long n, int16_t* out) override;
+
+    inline long long frames() const { return totalFrames; }
+
+private:
+    std::unique_ptr<PageSource> input;
+    std::shared_ptr<const Resampler> resampler;
+    long long inFrames, totalFrames;
+    int channels;
+    // Input frames [windowStart, windowEnd) by channel, capacity frames each.
+    // Frames outside the file are silent, windowEnd stops early where the
+    // input couldn't be read
+    std::vector<float> window;
+    long long capacity, windowStart = 0, windowEnd = 0;
+    bool failed = false; // a read of the input came up short
+    std::vector<float> interleaved; // input chunk as read
+    std::vector<float> converted; // output of readS16 before conversion
+
+    // Makes the window hold input frames [first, last), returns false if it
+    // couldn't read them all
+    bool fill(long long first, long long last);
+};
+
+#endif // RESAMPLER_H
@@ -0,0 +1,18 @@
+// Real-time safety checks for the audio thread
+#ifndef RTCHECK_H
+#define RTCHECK_H
+
+namespace RtCheck {
+#ifdef RT_ALLOC_CHECK
+    // While in scope, any heap allocation or deallocation made by the calling
+    // thread aborts the program. Build with `make RTCHECK=1` to enable
+    struct Scope {
+        Scope();
+        ~Scope();
+    };
+#else
+    struct Scope {};
+#endif
+}
+
+#endif // RTCHECK_H
@@ -0,0 +1,65 @@
+// Formats samples can be stored in, and conversions between them
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <cstddef>
+
+enum SampleStorage {
+    SAMPLE_F32,  // 32-bit float
+    SAMPLE_S16,  // 16-bit integer, half the memory, 96 dB of dynamic range
+    SAMPLE_F16,  // half precision float, half the memory, 11 bits of precision at any level
+    SAMPLE_STORAGES
+};
+
+namespace Storage {
+    const char* name(int storage);
+    // Storage named name, or -1
+    int find(const char* name);
+
+    inline size_t bytes(int storage) { return storage == SAMPLE_F32 ? sizeof(float) : sizeof(int16_t); }
+
+    inline float fromS16(int16_t s) { return s * (1.0f / 32768); }
+
+    inline int16_t toS16(float f) {
+        return static_cast<int16_t>(lrintf(std::fmax(-32768.0f, std::fmin(32767.0f, f * 32768))));
+    }
+
+    // The exponent and mantissa of a half shifted into place are a float
+    // 2^112 times too small, subnormals included
+    inline float fromF16(uint16_t h) {
+        uint32_t bits = (h & 0x7fffu) << 13;
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        f *= 0x1p112f;
+        memcpy(&bits, &f, sizeof(f));
+        bits |= (h & 0x8000u) << 16;
+        memcpy(&f, &bits, sizeof(f));
+        return f;
+    }
+
+    // Rounds to nearest even, saturates to the largest finite half
+    inline uint16_t toF16(float f) {
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof(bits));
+        uint16_t sign = (bits >> 16) & 0x8000;
+        bits &= 0x7fffffff;
+        if (bits >= 0x477ff000) // rounds to 65520 or more
+            return sign | 0x7bff;
+        if (bits < 0x38800000) { // below the smallest normal half
+            float a;
+            memcpy(&a, &bits, sizeof(a));
+            return sign | static_cast<uint16_t>(lrintf(a * 0x1p24f));
+        }
+        // rebias the exponent, rounding the dropped mantissa bits to even
+        bits += 0xc8000fff + ((bits >> 13) & 1);
+        return sign | static_cast<uint16_t>(bits >> 13);
+    }
+
+    // Converts n float samples to storage, out holds n samples of it
+    void convert(const float* in, size_t n, int storage, void* out);
+}
+
+#endif // STORAGE_H
@@ -0,0 +1,77 @@
+// Polyphonic voices, each a granular engine with its own pitch, position and
+// envelope
+#ifndef VOICES_H
+#define VOICES_H
+
+#include <vector>
+
+#include "granular.h"
+
+#define MAX_VOICES (8)
+// Voices render in chunks of at most this many frames
+#define VOICE_CHUNK_FRAMES (512)
+// Note whose pitch is the one set by the semitones and cents knobs
+#define ROOT_NOTE (60)
+
+struct AudioParams;
+
+// Note on, or note off when velocity is 0
+struct NoteEvent {
+    int note;
+    float velocity; // [0,1]
+    // Engine frame the event takes effect at, see AudioEngine::sendNote
+    long long frame;
+};
+
+struct Voice {
+    GranularEngine engine;
+    std::vector<float> buffer; // VOICE_CHUNK_FRAMES of stereo output
+    bool active = false;
+    bool released = false; // key let go, envelope heading to 0
+    int note = ROOT_NOTE;
+    float velocity = 1.0f;
+    float level = 0.0f; // envelope
+    unsigned long age = 0; // note on order, for stealing
+
+    Voice(int poolSize);
+};
+
+// Audio thread only, except for construction
+class VoiceManager {
+public:
+    std::vector<Voice> voices;
+
+    // params is the audio thread copy of the parameters, read every block
+    VoiceManager(const AudioParams& params, int nVoices, int poolSize, int sampleRate);
+
+    // Starts a note on a free voice, or steals the voice that will be missed
+    // least: the quietest released one, else the oldest
+    void noteOn(int note, float velocity);
+    void noteOff(int note);
+
+    // Applies parameter changes to the playing voices and moves them one 
+    // block closer to their targets, call once per block
+    void updateParameters(bool changed);
+
+    // Collects the voices to render in the next chunk, returns their count
+    int prepare();
+    // Renders the job-th prepared voice into its buffer, safe to run on 
+    // several threads at once for different jobs
+    void render(int job, int nFrames);
+    // Adds the rendered voices to out and frees voices that went silent
+    void mix(float* out, int nFrames);
+
+    inline int playing() const { return nPlaying; }
+
+private:
+    const AudioParams& params;
+    int sampleRate;
+    unsigned long noteCount = 0;
+    std::vector<int> jobs; // voices prepared for rendering
+    int nJobs = 0;
+    int nPlaying = 0;
+
+    GranularParams voiceParams(const Voice& v) const;
+};
+
+#endif // VOICES_H
@@ -0,0 +1,46 @@
+// Precomputed grain window shapes
+#ifndef WINDOW_H
+#define WINDOW_H
+
+#include <cstdint>
+
+#define WINDOW_TABLE_BITS (11)
+#define WINDOW_TABLE_SIZE (1 << WINDOW_TABLE_BITS)
+// Bits of the 32 bit window phase below the table index, used to interpolate
+#define WINDOW_FRAC_BITS (32 - WINDOW_TABLE_BITS)
+
+enum WindowShape {
+    WINDOW_HANN,
+    WINDOW_TUKEY,     // flat top with cosine tapers on the outer quarters
+    WINDOW_GAUSSIAN,
+    WINDOW_TRAPEZOID,
+    WINDOW_EXPODEC,   // fast attack, exponential decay
+    WINDOW_REXPODEC,  // exponential attack, fast decay
+    WINDOW_SHAPES
+};
+
+namespace Window {
+    // All tables, stored one after another. Each has WINDOW_TABLE_SIZE + 1
+    // points so reads can interpolate up to the end of the window
+    const float* tables();
+
+    // Offset of a shape's table from tables()
+    inline int offset(int shape) { return shape * (WINDOW_TABLE_SIZE + 1); }
+
+    const char* name(int shape);
+
+    // Fixed point phase step for a window lasting nFrames, the phase wraps
+    // from 0 to 2^32 over the window
+    inline uint32_t phaseIncrement(int nFrames) {
+        return nFrames > 1 ? static_cast<uint32_t>((1ull << 32) / nFrames) : UINT32_MAX;
+    }
+
+    // Window value at a fixed point phase, linearly interpolated
+    inline float read(const float* table, uint32_t phase) {
+        uint32_t i = phase >> WINDOW_FRAC_BITS;
+        float frac = (phase & ((1u << WINDOW_FRAC_BITS) - 1)) * (1.0f / (1u << WINDOW_FRAC_BITS));
+        return table[i] + frac * (table[i+1] - table[i]);
+    }
+}
+
+#endif // WINDOW_H
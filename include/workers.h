@@ -0,0 +1,44 @@
+// Threads that help the audio thread render, without locks on the audio side
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <semaphore>
+
+class WorkerPool {
+public:
+    typedef void (*Job)(void* context, int i);
+
+    WorkerPool(int nThreads);
+    ~WorkerPool();
+
+    // Runs job(context, i) for every i in [0, nJobs) on the workers and the
+    // calling thread, returns once all are done. Workers are woken through 
+    // semaphores and the caller spins, then yields, while the last jobs 
+    // finish. It never waits on a lock
+    void run(int nJobs, Job job, void* context);
+
+    inline int size() const { return static_cast<int>(workers.size()); }
+
+private:
+    struct Worker {
+        std::thread thread;
+        std::binary_semaphore wake{0}; // released once per batch
+    };
+    std::vector<std::unique_ptr<Worker>> workers;
+    // Current batch, written before workers are woken
+    Job job = nullptr;
+    void* context = nullptr;
+    int nJobs = 0;
+    std::atomic<int> next{0}; // next job to take
+    std::atomic<int> finished{0}; // workers done with the batch
+    std::atomic<bool> quit{false};
+
+    void work();
+    void loop(Worker& worker);
+};
+
+#endif // WORKERS_H
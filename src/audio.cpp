@@ -1,12 +1,11 @@
 /* audio.cpp
-Handles audio stream and audio processing objects */
+Handles the PortAudio stream that drives the audio engine */
 
 #include <iostream>
-#include <algorithm>
 
 #include "portaudio.h"
 #include "audio.h"
-#include "filemanager.h"
+#include "rtcheck.h"
 
 #define FRAMES_PER_BUFFER  (256)
 
@@ -14,27 +13,6 @@ static PaStream* stream;
 
 // Following objects declared in audio.h
 
-// -- AudioEngine struct defs --
-AudioEngine::AudioEngine(const int sr, AudioFileData aData, float vol)
-    : sampleRate(sr), audioData(aData), granEng(audioData), loop(false),
-    start(0.0f), end(1.0f), masterVolume(vol)
-{
-    std::cout << "AudioEngine created! Sample Rate = " << sampleRate << std::endl;
-}
-    
-void AudioEngine::processAudio(float& l, float& r) {
-    if (granularPlaying) {
-        granEng.playback(l, r);
-    }
-    // Handles looping
-    if (granEng.index + granEng.size * granEng.Ha >= end * audioData.frames * granEng.stretch) {
-        if (!loop) granularPlaying.store(false);
-        granEng.index = start * audioData.frames * granEng.stretch;
-    }
-    l *= masterVolume.load();
-    r *= masterVolume.load();
-}
-
 // Where audio processing happens for each buffer
 static int paCallback( const void *inputBuffer, void *outputBuffer,
                             unsigned long framesPerBuffer,
@@ -42,23 +20,19 @@ static int paCallback( const void *inputBuffer, void *outputBuffer,
                             PaStreamCallbackFlags statusFlags,
                             void *userData )
 {
+    [[maybe_unused]] RtCheck::Scope rtScope; // no heap activity past this point
     AudioEngine* engine = static_cast<AudioEngine*>(userData);
     float *out = (float*)outputBuffer;
-    unsigned long i;
-
-    (void) timeInfo; /* Prevent unused variable warnings. */
-    (void) statusFlags;
-    (void) inputBuffer;
 
-    for(i=0; i<framesPerBuffer; i++) {
-        float left = 0.;
-        float right = 0.;
+    (void) inputBuffer; /* Prevent unused variable warnings. */
 
-        engine->processAudio(left, right);
-
-        *out++ = left; /* left */
-        *out++ = right;  /* right */
-    }
+    // timed against the buffer deadline, along with the xruns the device
+    // reports and the latency to the DAC
+    engine->profiler.begin();
+    engine->processBlock(out, framesPerBuffer);
+    engine->profiler.end(framesPerBuffer, engine->sampleRate,
+        statusFlags & paOutputUnderflow, statusFlags & paOutputOverflow,
+        timeInfo ? timeInfo->outputBufferDacTime - timeInfo->currentTime : 0.0);
 
     return paContinue;
 }
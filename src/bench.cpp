@@ -0,0 +1,304 @@
+/* bench.cpp
+glaive-bench, microbenchmarks for the granular hot path. Times GrainPool::render
+on its own and GranularEngine::processBlock with triggering included, across
+densities, pitches, reverse probabilities, source channel counts and with the
+randomizers on or off. The long suite plays grains lasting the whole run, 
+forward and reverse, and checks the kernel in use renders them like the scalar
+one before timing them. Results can be printed as a table, CSV or JSON to track
+regressions between releases */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+
+#include "granular.h"
+#include "kernels.h"
+#include "random.h"
+
+#define BENCH_SAMPLE_RATE (44100)
+#define BENCH_BLOCK (256)
+#define BENCH_RUNS (3) // best of, to filter out scheduling noise
+// Frames of each grain of the pool suite, as they end new ones take their place
+#define BENCH_GRAIN_FRAMES (8192)
+// Grains of the long suite, which last the whole run
+#define BENCH_LONG_GRAINS (8)
+// Largest difference from the scalar kernel accepted in the long suite
+#define BENCH_TOLERANCE (1e-5f)
+
+struct BenchCase {
+    const char* suite; // "pool", "long" or "engine"
+    int channels, density, semitones, revprob;
+    bool randomize; // jitter, random pan and spread
+};
+
+struct BenchResult {
+    BenchCase c;
+    double nsPerFrame;
+    double grainFramesPerSec; // frames of grain output produced per second
+};
+
+// Deterministic noise, long enough for grains at up to twice the speed
+static AudioFileData makeSource(int channels, double seconds, int sampleStorage) {
+    Random random(1);
+    AudioFileData data(static_cast<int>(seconds * BENCH_SAMPLE_RATE), channels, BENCH_SAMPLE_RATE, 
+        sampleStorage);
+    std::vector<float> samples(data.size);
+    random.uniform(samples.data(), samples.size());
+    for (float& s : samples)
+        s = s * 2.0f - 1.0f;
+    Storage::convert(samples.data(), samples.size(), sampleStorage, data.raw());
+    data.setReady(data.frames);
+    return data;
+}
+
+// Cases that could not run as set up or rendered wrong, the run fails
+static int failures = 0;
+
+static void fail(const BenchCase& c, const std::string& what) {
+    std::cerr << c.suite << " case, " << c.channels << " ch, density " << c.density << ", "
+        << c.semitones << " semitones, reverse " << c.revprob << "%: " << what << std::endl;
+    failures++;
+}
+
+// Starts grains until density play, reading from successive spots of the
+// source. Returns false if the pool refused one
+static bool fillPool(GrainPool& pool, const BenchCase& c, int length, float pitch, Random& random,
+    long long& next)
+{
+    const long long spots = std::max<long long>(1, 
+        pool.data->frames - static_cast<long long>(ceil(length * pitch)) - 1);
+    while (pool.active < c.density) {
+        float pan = c.randomize ? random.uniform() : 0.5f;
+        if (!pool.trigger((next++ * 4801) % spots, length, pan, pitch, random.uniform() * 100 < c.revprob))
+            return false;
+    }
+    return true;
+}
+
+// Renders frames of a pool playing density grains of length frames, new
+// grains taking the place of those that end. Returns the render time, or a
+// negative one if the pool didn't play as expected
+static double runPool(const BenchCase& c, const AudioFileData& source, int frames, int length,
+    float* out, int outFrames)
+{
+    GrainPool pool(c.density, &source);
+    Random random(2);
+    const float pitch = pow(2.0f, c.semitones / 12.0f);
+    long long next = 0;
+    std::chrono::duration<double> t(0);
+    for (int pos = 0; pos < frames; pos += BENCH_BLOCK) {
+        if (!fillPool(pool, c, length, pitch, random, next)) {
+            fail(c, "a grain was refused by the pool");
+            return -1.0;
+        }
+        int n = std::min(BENCH_BLOCK, frames - pos);
+        float* block = out + (pos % outFrames) * 2;
+        std::fill(block, block + n * 2, 0.0f);
+        auto t0 = std::chrono::steady_clock::now();
+        pool.render(block, n);
+        t += std::chrono::steady_clock::now() - t0;
+    }
+    // grains as long as the run have all ended, shorter ones were replaced
+    int expected = length >= frames ? 0 : c.density;
+    if (pool.active != expected || pool.dropped != 0 || pool.missed != 0 || pool.tooLong != 0) {
+        fail(c, std::to_string(pool.active) + " grains left playing instead of " + std::to_string(expected));
+        return -1.0;
+    }
+    return t.count();
+}
+
+// Grains keep the pool full for the whole run, each BENCH_GRAIN_FRAMES long
+static BenchResult benchPool(const BenchCase& c, const AudioFileData& source, int frames) {
+    std::vector<float> out(BENCH_BLOCK * 2);
+    double best = 1e30;
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        double t = runPool(c, source, frames, BENCH_GRAIN_FRAMES, out.data(), BENCH_BLOCK);
+        if (t < 0)
+            break;
+        best = std::min(best, t);
+    }
+    return {c, best * 1e9 / frames, 1.0 * c.density * frames / best};
+}
+
+// Grains as long as the whole run, the case that drifts furthest from
+// where it should read. The kernel in use must render them like the scalar
+// one before they are timed
+static BenchResult benchLong(const BenchCase& c, const AudioFileData& source, int frames) {
+    std::vector<float> out(frames * 2), reference(frames * 2);
+    const std::string kernel = Kernels::selected();
+    Kernels::select("scalar");
+    bool ok = runPool(c, source, frames, frames, reference.data(), frames) >= 0;
+    Kernels::select(kernel.c_str());
+    ok = ok && runPool(c, source, frames, frames, out.data(), frames) >= 0;
+    float worst = 0.0f;
+    for (int i = 0; ok && i < frames * 2; i++)
+        worst = std::max(worst, fabsf(out[i] - reference[i]));
+    if (worst > BENCH_TOLERANCE)
+        fail(c, "differs from the scalar kernel by " + std::to_string(worst));
+    double best = 1e30;
+    for (int run = 0; ok && run < BENCH_RUNS; run++)
+        best = std::min(best, runPool(c, source, frames, frames, out.data(), frames));
+    return {c, best * 1e9 / frames, 1.0 * c.density * frames / best};
+}
+
+static BenchResult benchEngine(const BenchCase& c, const AudioFileData& source, int frames) {
+    GranularParams params;
+    params.Ha = 3000;
+    params.stretch = 1.0f;
+    params.density = c.density;
+    params.semitones = c.semitones;
+    params.revprob = c.revprob;
+    if (c.randomize) {
+        params.jitterAmount = 0.5f;
+        params.randomPanAmt = 1.0f;
+        params.spread = 0.1f;
+    }
+    std::vector<float> out(BENCH_BLOCK * 2);
+    double best = 1e30;
+    long grainFrames = 0;
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        GranularEngine engine(&source, params);
+        engine.seed(3);
+        std::chrono::duration<double> t(0);
+        grainFrames = 0;
+        for (int pos = 0; pos < frames; pos += BENCH_BLOCK) {
+            int n = std::min(BENCH_BLOCK, frames - pos);
+            auto t0 = std::chrono::steady_clock::now();
+            engine.processBlock(out.data(), n);
+            t += std::chrono::steady_clock::now() - t0;
+            // sampled at block ends, outside the timed region
+            grainFrames += static_cast<long>(engine.grains.active) * n;
+        }
+        best = std::min(best, t.count());
+    }
+    return {c, best * 1e9 / frames, grainFrames / best};
+}
+
+// Of the sources, set from the command line
+static int storage = SAMPLE_F32;
+
+static void printTable(const std::vector<BenchResult>& results) {
+    std::cout << std::left << std::setw(8) << "suite" << std::right
+        << std::setw(4) << "ch" << std::setw(9) << "density" << std::setw(7) << "semis"
+        << std::setw(5) << "rev" << std::setw(6) << "rand"
+        << std::setw(14) << "ns/frame" << std::setw(18) << "grain frames/s" << "\n";
+    std::cout << std::fixed;
+    for (const BenchResult& r : results) {
+        std::cout << std::left << std::setw(8) << r.c.suite << std::right
+            << std::setw(4) << r.c.channels << std::setw(9) << r.c.density
+            << std::setw(7) << r.c.semitones << std::setw(5) << r.c.revprob
+            << std::setw(6) << (r.c.randomize ? "on" : "off")
+            << std::setw(14) << std::setprecision(2) << r.nsPerFrame
+            << std::setw(18) << std::setprecision(0) << r.grainFramesPerSec << "\n";
+    }
+}
+
+static void printCsv(const std::vector<BenchResult>& results) {
+    std::cout << "suite,kernel,storage,channels,density,semitones,revprob,randomize,ns_per_frame,grain_frames_per_s\n";
+    for (const BenchResult& r : results) {
+        std::cout << r.c.suite << "," << Kernels::selected() << "," << Storage::name(storage) << "," 
+            << r.c.channels << ","
+            << r.c.density << "," << r.c.semitones << "," << r.c.revprob << ","
+            << r.c.randomize << "," << r.nsPerFrame << "," << r.grainFramesPerSec << "\n";
+    }
+}
+
+static void printJson(const std::vector<BenchResult>& results) {
+    std::cout << "{\n  \"kernel\": \"" << Kernels::selected() << "\",\n  \"storage\": \"" 
+        << Storage::name(storage) << "\",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        std::cout << "    {\"suite\": \"" << r.c.suite << "\", \"channels\": " << r.c.channels
+            << ", \"density\": " << r.c.density << ", \"semitones\": " << r.c.semitones
+            << ", \"revprob\": " << r.c.revprob
+            << ", \"randomize\": " << (r.c.randomize ? "true" : "false")
+            << ", \"ns_per_frame\": " << r.nsPerFrame
+            << ", \"grain_frames_per_s\": " << r.grainFramesPerSec << "}"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    std::cout << "  ]\n}\n";
+}
+
+int main(int argc, char** argv) {
+    std::string format = "table";
+    double seconds = 1.0; // of audio per case and run
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--format") == 0 && a + 1 < argc) {
+            format = argv[++a];
+        } else if (strcmp(argv[a], "--seconds") == 0 && a + 1 < argc) {
+            seconds = std::max(0.01, atof(argv[++a]));
+        } else if (strcmp(argv[a], "--kernel") == 0 && a + 1 < argc) {
+            if (!Kernels::select(argv[++a])) {
+                std::cerr << "Kernel not available: " << argv[a] << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[a], "--storage") == 0 && a + 1 < argc) {
+            storage = Storage::find(argv[++a]);
+            if (storage < 0) {
+                std::cerr << "Unknown storage: " << argv[a] << std::endl;
+                return 1;
+            }
+        } else {
+            std::cerr << "Usage: glaive-bench [--format table|csv|json] [--seconds <s>] "
+                "[--kernel avx2|sse2|scalar] [--storage f32|s16|f16]" << std::endl;
+            return 1;
+        }
+    }
+    if (format != "table" && format != "csv" && format != "json") {
+        std::cerr << "Unknown format: " << format << std::endl;
+        return 1;
+    }
+
+    const int frames = static_cast<int>(seconds * BENCH_SAMPLE_RATE);
+    // twice the run for grains an octave up, plus room for spread
+    const AudioFileData sources[2] = {
+        makeSource(1, seconds * 2.5 + 1, storage), makeSource(2, seconds * 2.5 + 1, storage)
+    };
+    const int densities[] = {1, 2, 4, 8, 16, 32, MAX_DENSITY};
+    const int pitches[] = {-12, 0, 7, 12};
+    const int revprobs[] = {0, 50};
+
+    std::vector<BenchResult> results;
+    for (const char* suite : {"pool", "engine"}) {
+        for (int channels = 1; channels <= 2; channels++) {
+            for (int density : densities) {
+                for (int semitones : pitches) {
+                    for (int revprob : revprobs) {
+                        for (bool randomize : {false, true}) {
+                            BenchCase c = {suite, channels, density, semitones, revprob, randomize};
+                            const AudioFileData& source = sources[channels - 1];
+                            results.push_back(strcmp(suite, "pool") == 0
+                                ? benchPool(c, source, frames)
+                                : benchEngine(c, source, frames));
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    for (int channels = 1; channels <= 2; channels++) {
+        for (int semitones : {7, 12}) {
+            for (int revprob : {0, 100}) {
+                BenchCase c = {"long", channels, BENCH_LONG_GRAINS, semitones, revprob, false};
+                results.push_back(benchLong(c, sources[channels - 1], frames));
+            }
+        }
+    }
+
+    if (format == "csv") {
+        printCsv(results);
+    } else if (format == "json") {
+        printJson(results);
+    } else {
+        std::cout << "Kernel: " << Kernels::selected() << ", " << Storage::name(storage) << " samples, " 
+            << seconds << " s of audio per case, best of " << BENCH_RUNS << "\n";
+        printTable(results);
+    }
+    return failures > 0 ? 1 : 0;
+}
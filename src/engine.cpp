@@ -0,0 +1,186 @@
+/* engine.cpp
+Audio processing shared by the realtime stream and offline rendering */
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+#include "engine.h"
+
+// -- AudioEngine struct defs --
+AudioEngine::AudioEngine(const int sr, float vol, int poolSize, int nVoices, int nWorkers)
+    : sampleRate(sr), granEng(nullptr, {}, poolSize), 
+      voices(live, nVoices, poolSize, sr), volume(vol),
+      workers(nWorkers >= 0 ? nWorkers 
+          : std::min<int>(nVoices, std::max(1u, std::thread::hardware_concurrency()) - 1))
+{
+    granEng.sampleRate = sr;
+    granEng.eventQueue = &grainEvents;
+    // each engine follows its own cursor through paged samples
+    for (size_t v = 0; v < voices.voices.size(); v++)
+        voices.voices[v].engine.cursor = 1 + v;
+    params.volume = vol;
+    live = params;
+    paramBuffer.publish(params);
+    std::cout << "AudioEngine created! Sample Rate = " << sampleRate << std::endl;
+}
+
+void AudioEngine::publishParams() {
+    paramBuffer.publish(params);
+}
+
+bool AudioEngine::sendNote(int note, float velocity, long long frame) {
+    return notes.push({note, velocity, frame});
+}
+
+void AudioEngine::loadSample(std::shared_ptr<const AudioFileData> data) {
+    std::lock_guard<std::mutex> lock(sampleMutex);
+    latest = data;
+    inFlight.push_back(data);
+    // a buffer still pending was never seen by the audio thread
+    const AudioFileData* skipped = pending.exchange(data.get(), std::memory_order_acq_rel);
+    if (skipped)
+        release(skipped);
+}
+
+std::shared_ptr<const AudioFileData> AudioEngine::sample() {
+    std::lock_guard<std::mutex> lock(sampleMutex);
+    return latest;
+}
+
+void AudioEngine::collectSamples() {
+    std::lock_guard<std::mutex> lock(sampleMutex);
+    const AudioFileData* data;
+    while (retired.pop(data))
+        release(data);
+}
+
+void AudioEngine::release(const AudioFileData* data) {
+    auto it = std::find_if(inFlight.begin(), inFlight.end(),
+        [data](const auto& p) { return p.get() == data; });
+    if (it != inFlight.end())
+        inFlight.erase(it);
+}
+
+void AudioEngine::dropSample(const AudioFileData* data) {
+    for (SampleUse& use : sampleUses) {
+        if (use.data == data && --use.engines == 0) {
+            use.data = nullptr;
+            retire(data);
+        }
+    }
+}
+
+void AudioEngine::collectReleased(GranularEngine& engine) {
+    while (const AudioFileData* old = engine.takeReleased())
+        dropSample(old);
+}
+
+void AudioEngine::renderJob(void* context, int job) {
+    AudioEngine* engine = static_cast<AudioEngine*>(context);
+    if (job > 0) {
+        engine->voices.render(job - 1, engine->chunkFrames);
+    } else if (engine->granularPlaying.load()) {
+        // the transport stops at the end point unless looping
+        const AudioParams& p = engine->live;
+        if (!engine->granEng.playRegion(engine->chunkOut, engine->chunkFrames, p.start, p.end, p.loop))
+            engine->granularPlaying.store(false);
+    }
+}
+
+void AudioEngine::retire(const AudioFileData* data) {
+    if (data && retireBacklogSize < 4)
+        retireBacklog[retireBacklogSize++] = data;
+    // if the main thread stalls the backlog fills up and buffers are leaked
+    // rather than freed here
+    while (retireBacklogSize > 0 && retired.push(retireBacklog[0])) {
+        retireBacklogSize--;
+        std::copy(retireBacklog + 1, retireBacklog + 1 + retireBacklogSize, retireBacklog);
+    }
+}
+    
+void AudioEngine::processBlock(float* out, unsigned long nFrames) {
+    std::fill(out, out + nFrames * 2, 0.0f);
+    // Parameters only change between blocks
+    bool changed = paramBuffer.update();
+    if (changed) {
+        live = paramBuffer.read();
+        granEng.setParameters(live.granular);
+    }
+    granEng.smoothParameters();
+    voices.updateParameters(changed);
+    if (const AudioFileData* next = pending.exchange(nullptr, std::memory_order_acq_rel)) {
+        int fade = live.crossfade * sampleRate;
+        // with every slot taken by buffers still fading out, the fades are
+        // cut so the engines let go of all but next and free the slots
+        if (std::none_of(std::begin(sampleUses), std::end(sampleUses), 
+                [](const SampleUse& use) { return use.data == nullptr; })) {
+            fade = 0;
+            fadesCut.store(fadesCut.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+        granEng.setSample(next, granularPlaying.load() ? fade : 0);
+        collectReleased(granEng);
+        for (Voice& v : voices.voices) {
+            v.engine.setSample(next, v.active ? fade : 0);
+            collectReleased(v.engine);
+        }
+        // registered once the old buffers were dropped, a slot is free by now
+        for (SampleUse& use : sampleUses) {
+            if (!use.data) {
+                use = {next, 1 + static_cast<int>(voices.voices.size())};
+                break;
+            }
+        }
+    }
+    if (rewind.exchange(false))
+        granEng.seek(0);
+    // the transport and every voice render in parallel, chunk by chunk. 
+    // Chunks end where a note is due, so notes start on their exact frame
+    const long long blockStart = framesRendered.load(std::memory_order_relaxed);
+    for (unsigned long pos = 0; pos < nFrames; pos += chunkFrames) {
+        const long long now = blockStart + pos;
+        NoteEvent note;
+        while (notes.peek(note) && note.frame <= now) {
+            notes.pop(note);
+            if (note.velocity > 0)
+                voices.noteOn(note.note, note.velocity);
+            else
+                voices.noteOff(note.note);
+        }
+        chunkOut = out + pos * 2;
+        chunkFrames = std::min<unsigned long>(VOICE_CHUNK_FRAMES, nFrames - pos);
+        if (notes.peek(note) && note.frame < now + chunkFrames)
+            chunkFrames = note.frame - now;
+        workers.run(1 + voices.prepare(), renderJob, this);
+        voices.mix(chunkOut, chunkFrames);
+    }
+    framesRendered.store(blockStart + nFrames, std::memory_order_relaxed);
+    // fades only advance while their engine renders, a stopped transport
+    // or a silent voice would keep the old data alive
+    if (!granularPlaying.load())
+        granEng.stopFade();
+    for (Voice& v : voices.voices) {
+        if (!v.active)
+            v.engine.stopFade();
+    }
+    // hand data grains stopped reading to the main thread, retrying the backlog
+    collectReleased(granEng);
+    for (Voice& v : voices.voices)
+        collectReleased(v.engine);
+    retire(nullptr);
+    playIndex.store(granEng.index, std::memory_order_relaxed);
+    voicesPlaying.store(voices.playing(), std::memory_order_relaxed);
+    grainsDropped.store(granEng.grains.dropped, std::memory_order_relaxed);
+    grainsMissed.store(granEng.grains.missed, std::memory_order_relaxed);
+    grainsTooLong.store(granEng.grains.tooLong, std::memory_order_relaxed);
+
+    // ramp the master volume across the block
+    const float nextVolume = volume + (live.volume - volume) * PARAM_SMOOTHING;
+    const float step = (nextVolume - volume) / nFrames;
+    for (unsigned long i = 0; i < nFrames; i++) {
+        float v = volume + step * i;
+        out[i*2] *= v;
+        out[i*2+1] *= v;
+    }
+    volume = fabsf(live.volume - nextVolume) < 1e-5f ? live.volume : nextVolume;
+}
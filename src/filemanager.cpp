@@ -6,6 +6,10 @@ working directory */
 #include <vector>
 #include <iostream>
 #include <algorithm>
+#include <filesystem>
+#include <climits>
+#include <thread>
+#include <chrono>
 
 // Include all required dr_libs
 #define DR_WAV_IMPLEMENTATION
@@ -18,58 +22,428 @@ working directory */
 #include "filemanager.h"
 
 // AudioFileData struct def
-AudioFileData::AudioFileData(std::vector<float> samplesVec, int numChannels, int sRate) 
-    : samples(samplesVec), nChannels(numChannels), sampleRate(sRate), size(samples.size()), frames(size/nChannels) {}
-
-AudioFileData FileManager::LoadAudioFile(std::string filename) {
-    std::transform(filename.begin(), filename.end(), filename.begin(), ::tolower); // Normalize extension
-
-    if (filename.ends_with(".wav")) {
-        // Read WAV
-        unsigned int channels;
-        unsigned int sampleRate;
-        drflac_uint64 totalPCMFrameCount;
-        float* pSampleData = drwav_open_file_and_read_pcm_frames_f32(filename.c_str(), &channels, &sampleRate, &totalPCMFrameCount, NULL);
-        if (pSampleData == NULL) {
-            std::cerr << "Failed to open and decode WAV file: " << filename << std::endl;
-            return {};
+AudioFileData::AudioFileData(long long numFrames, int numChannels, int sRate, int sampleStorage, 
+    int pageSlots) 
+    : storage(pageSlots > 0 ? SAMPLE_F32 : sampleStorage), nChannels(numChannels), sampleRate(sRate), 
+    size(static_cast<size_t>(numFrames) * numChannels), frames(numFrames) 
+{
+    size_t n = pageSlots > 0 
+        ? static_cast<size_t>(pageSlots) * PageStore::SLOT_STRIDE * numChannels
+        : (static_cast<size_t>(numFrames) + 2 * GUARD_FRAMES) * numChannels;
+    if (storage == SAMPLE_F32)
+        samples.resize(n, 0.0f);
+    else
+        compact.resize(n, 0); // zero is silence in both formats
+}
+
+AudioFileData::AudioFileData(std::unique_ptr<PcmCache::MappedFile> mappedFile)
+    : storage(mappedFile->header().storage), nChannels(mappedFile->header().nChannels), 
+    sampleRate(mappedFile->header().sampleRate),
+    size(static_cast<size_t>(mappedFile->header().frames) * nChannels), 
+    frames(mappedFile->header().frames), mapped(std::move(mappedFile)), framesReady(frames)
+{}
+
+AudioFileData::AudioFileData(AudioFileData&& other) noexcept
+    : samples(std::move(other.samples)), compact(std::move(other.compact)), storage(other.storage),
+    nChannels(other.nChannels), 
+    sampleRate(other.sampleRate), size(other.size), frames(other.frames), 
+    pages(std::move(other.pages)), mapped(std::move(other.mapped)), peaks(std::move(other.peaks)), 
+    framesReady(other.ready()) 
+{}
+
+AudioFileData& AudioFileData::operator=(AudioFileData&& other) noexcept {
+    samples = std::move(other.samples);
+    compact = std::move(other.compact);
+    storage = other.storage;
+    nChannels = other.nChannels;
+    sampleRate = other.sampleRate;
+    size = other.size;
+    frames = other.frames;
+    pages = std::move(other.pages);
+    mapped = std::move(other.mapped);
+    peaks = std::move(other.peaks);
+    setReady(other.ready());
+    return *this;
+}
+
+// -- Decoders --
+// Each keeps its read position so sequential reads never seek
+
+class WavSource : public PageSource {
+public:
+    drwav wav;
+    bool opened;
+    long long position = 0;
+    WavSource(const std::string& filename) : opened(drwav_init_file(&wav, filename.c_str(), NULL)) {}
+    ~WavSource() { if (opened) drwav_uninit(&wav); }
+    long long read(long long first, long long n, float* out) override {
+        if (first != position && !drwav_seek_to_pcm_frame(&wav, first))
+            return 0;
+        position = first + drwav_read_pcm_frames_f32(&wav, n, out);
+        return position - first;
+    }
+    long long readS16(long long first, long long n, int16_t* out) override {
+        if (first != position && !drwav_seek_to_pcm_frame(&wav, first))
+            return 0;
+        position = first + drwav_read_pcm_frames_s16(&wav, n, out);
+        return position - first;
+    }
+};
+
+class FlacSource : public PageSource {
+public:
+    drflac* flac;
+    long long position = 0;
+    FlacSource(drflac* flac) : flac(flac) {}
+    ~FlacSource() { drflac_close(flac); }
+    long long read(long long first, long long n, float* out) override {
+        if (first != position && !drflac_seek_to_pcm_frame(flac, first))
+            return 0;
+        position = first + drflac_read_pcm_frames_f32(flac, n, out);
+        return position - first;
+    }
+    long long readS16(long long first, long long n, int16_t* out) override {
+        if (first != position && !drflac_seek_to_pcm_frame(flac, first))
+            return 0;
+        position = first + drflac_read_pcm_frames_s16(flac, n, out);
+        return position - first;
+    }
+};
+
+// Seeking an MP3 decodes from the start, so MP3 files are never paged or
+// decoded in parallel
+class Mp3Source : public PageSource {
+public:
+    drmp3 mp3;
+    bool opened;
+    long long position = 0;
+    Mp3Source(const std::string& filename) : opened(drmp3_init_file(&mp3, filename.c_str(), NULL)) {}
+    ~Mp3Source() { if (opened) drmp3_uninit(&mp3); }
+    long long read(long long first, long long n, float* out) override {
+        if (first != position && !drmp3_seek_to_pcm_frame(&mp3, first))
+            return 0;
+        position = first + drmp3_read_pcm_frames_f32(&mp3, n, out);
+        return position - first;
+    }
+    long long readS16(long long first, long long n, int16_t* out) override {
+        if (first != position && !drmp3_seek_to_pcm_frame(&mp3, first))
+            return 0;
+        position = first + drmp3_read_pcm_frames_s16(&mp3, n, out);
+        return position - first;
+    }
+};
+
+// Opens another decoder on the same file, for decoding a range in parallel
+typedef std::function<std::unique_ptr<PageSource>()> SourceOpener;
+
+// Makes source, and every source reopen opens, convert the file from
+// sampleRate to rate as it is read. frames and sampleRate become those of
+// the converted audio
+static void Resample(std::unique_ptr<PageSource>& source, SourceOpener& reopen, long long& frames,
+    int channels, int& sampleRate, int rate)
+{
+    if (rate <= 0 || rate == sampleRate || frames <= 0)
+        return;
+    auto resampler = std::make_shared<const Resampler>(sampleRate, rate);
+    const long long inFrames = frames;
+    source = std::make_unique<ResampledSource>(std::move(source), resampler, inFrames, channels);
+    if (reopen) {
+        reopen = [opener = reopen, resampler, inFrames, channels]() -> std::unique_ptr<PageSource> {
+            auto more = opener();
+            return more ? std::make_unique<ResampledSource>(std::move(more), resampler, inFrames, channels)
+                : nullptr;
+        };
+    }
+    frames = resampler->outFrames(inFrames);
+    sampleRate = rate;
+}
+
+// Gives a sample its peaks, before anything else can see it. Returns true if
+// they were restored whole from the cache
+static bool StartPeaks(const std::string& filename, AudioFileData& data) {
+    if (!FileManager::buildPeaks)
+        return false;
+    data.peaks = std::make_unique<PeakPyramid>(data.frames, data.nChannels);
+    return PcmCache::FindPeaks(filename, *data.peaks);
+}
+
+// Keeps peaks built while loading in the cache
+static void StorePeaks(const std::string& filename, const AudioFileData& data, bool cached) {
+    if (data.peaks && !cached)
+        PcmCache::StorePeaks(filename, *data.peaks);
+}
+
+// Adds frames [first, last) of a sample in memory to its peaks
+static void AddPeaks(const AudioFileData& data, long long first, long long last) {
+    if (!data.peaks || data.peaks->built() == data.frames)
+        return;
+    const int ch = data.nChannels;
+    if (data.storage == SAMPLE_F32) {
+        data.peaks->add(data.data() + first * ch, last - first);
+        return;
+    }
+    std::vector<float> chunk(DECODE_CHUNK_FRAMES * ch);
+    for (long long f = first; f < last; f += DECODE_CHUNK_FRAMES) {
+        long long n = std::min<long long>(DECODE_CHUNK_FRAMES, last - f);
+        for (long long i = 0; i < n * ch; i++)
+            chunk[i] = data.sample(f * ch + i);
+        data.peaks->add(chunk.data(), n);
+    }
+}
+
+// Decodes straight into the final buffer a chunk at a time, so the audio is
+// held in memory only once and the sample can play after the first chunk.
+// Files long enough are split into one range per core, each decoded by a
+// decoder of its own into its slice of the buffer. The calling thread decodes
+// the first range and moves the ready watermark over every range done
+static std::shared_ptr<const AudioFileData> Decode(const std::string& filename, const char* format,
+    std::unique_ptr<PageSource> source, const SourceOpener& reopen, long long totalFrames, 
+    int channels, int sampleRate, int storage, const FileManager::SampleStartCallback& onStart) 
+{
+    // the render kernels address samples with 32-bit offsets
+    if (totalFrames <= 0 || (totalFrames + 2 * GUARD_FRAMES) * channels > INT_MAX) {
+        std::cerr << format << " file is empty or too long: " << filename << std::endl;
+        return nullptr;
+    }
+    auto data = std::make_shared<AudioFileData>(totalFrames, channels, sampleRate, storage);
+    const bool peaksCached = StartPeaks(filename, *data);
+
+    std::vector<std::unique_ptr<PageSource>> sources;
+    sources.push_back(std::move(source));
+    if (reopen) {
+        long long maxRanges = std::min<long long>(std::max(1u, std::thread::hardware_concurrency()),
+            totalFrames / DECODE_MIN_RANGE_FRAMES);
+        while (static_cast<long long>(sources.size()) < maxRanges) {
+            auto more = reopen();
+            if (!more)
+                break;
+            sources.push_back(std::move(more));
+        }
+    }
+    // ranges start on chunk boundaries
+    const int nRanges = sources.size();
+    const long long rangeFrames = (totalFrames / nRanges + DECODE_CHUNK_FRAMES - 1) 
+        / DECODE_CHUNK_FRAMES * DECODE_CHUNK_FRAMES;
+    auto rangeStart = [&](int k) { return std::min(k * rangeFrames, totalFrames); };
+    std::vector<std::atomic<long long>> decoded(nRanges); // frames done per range
+    std::atomic<int> running{nRanges - 1};
+
+    // stops at the end of the range, or at the first read that fails. S16 is
+    // decoded straight to integers, F16 is converted from float a chunk at a
+    // time
+    auto decodeRange = [&](int k, const std::function<void()>& onChunk) {
+        const long long first = rangeStart(k), length = rangeStart(k + 1) - first;
+        std::vector<float> chunk(storage == SAMPLE_F16 ? DECODE_CHUNK_FRAMES * channels : 0);
+        long long done = 0;
+        while (done < length) {
+            long long n = std::min<long long>(DECODE_CHUNK_FRAMES, length - done);
+            const size_t offset = (first + done) * channels;
+            long long got;
+            if (storage == SAMPLE_S16) {
+                got = sources[k]->readS16(first + done, n, static_cast<int16_t*>(data->raw()) + offset);
+            } else if (storage == SAMPLE_F16) {
+                got = sources[k]->read(first + done, n, chunk.data());
+                Storage::convert(chunk.data(), got * channels, storage, 
+                    static_cast<uint16_t*>(data->raw()) + offset);
+            } else {
+                got = sources[k]->read(first + done, n, data->data() + offset);
+            }
+            if (got == 0)
+                break;
+            done += got;
+            decoded[k].store(done, std::memory_order_release);
+            if (onChunk)
+                onChunk();
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int k = 1; k < nRanges; k++) {
+        threads.emplace_back([&, k]() {
+            decodeRange(k, {});
+            running.fetch_sub(1, std::memory_order_release);
+        });
+    }
+
+    // the watermark covers every complete range and the part of the next one
+    // decoded so far
+    long long ready = 0;
+    auto advance = [&]() {
+        long long prefix = 0;
+        for (int k = 0; k < nRanges; k++) {
+            long long done = decoded[k].load(std::memory_order_acquire);
+            prefix = rangeStart(k) + done;
+            if (done < rangeStart(k + 1) - rangeStart(k))
+                break;
+        }
+        if (prefix > ready) {
+            bool first = ready == 0;
+            AddPeaks(*data, ready, prefix);
+            ready = prefix;
+            data->setReady(ready);
+            if (first && onStart)
+                onStart(data);
+        }
+    };
+    // the watermark follows the first range a chunk at a time so playback
+    // can start early
+    decodeRange(0, advance);
+    while (running.load(std::memory_order_acquire) > 0) {
+        advance();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    for (std::thread& t : threads)
+        t.join();
+    advance();
+
+    if (ready == 0) {
+        std::cerr << "Failed to decode " << format << " file: " << filename << std::endl;
+        return nullptr;
+    }
+    // a short read leaves the rest of the buffer silent and unplayed
+    if (ready < data->frames)
+        std::cerr << format << " file is truncated, decoded " << ready << " of " 
+            << data->frames << " frames: " << filename << std::endl;
+    StorePeaks(filename, *data, peaksCached);
+    return data;
+}
+
+// Streams the file through a page cache filling the memory budget, every
+// frame is addressable from the start. The peaks are built by another
+// decoder reading the file through once
+static std::shared_ptr<const AudioFileData> Page(const std::string& filename, 
+    std::unique_ptr<PageSource> source, const SourceOpener& reopen, long long totalFrames, int channels, int sampleRate, 
+    const FileManager::SampleStartCallback& onStart) 
+{
+    // the arena is addressed with 32-bit offsets as well
+    long long slotSamples = 1LL * PageStore::SLOT_STRIDE * channels;
+    long long slots = std::clamp<long long>(FileManager::memoryBudget / (slotSamples * sizeof(float)), 
+        MIN_PAGE_SLOTS, INT_MAX / slotSamples);
+    auto data = std::make_shared<AudioFileData>(totalFrames, channels, sampleRate, SAMPLE_F32, 
+        static_cast<int>(slots));
+    data->pages = std::make_unique<PageStore>(std::move(source), data->samples.data(), 
+        totalFrames, channels, static_cast<int>(slots));
+    data->setReady(totalFrames);
+    const bool peaksCached = StartPeaks(filename, *data);
+    data->pages->start();
+    if (onStart)
+        onStart(data);
+
+    std::unique_ptr<PageSource> scan = data->peaks && !peaksCached ? reopen() : nullptr;
+    if (scan) {
+        std::vector<float> chunk(DECODE_CHUNK_FRAMES * channels);
+        long long got;
+        for (long long f = 0; f < totalFrames; f += got) {
+            got = scan->read(f, std::min<long long>(DECODE_CHUNK_FRAMES, totalFrames - f), chunk.data());
+            if (got == 0)
+                break;
+            data->peaks->add(chunk.data(), got);
+        }
+        StorePeaks(filename, *data, peaksCached);
+    }
+    return data;
+}
+
+// Keeps a fully decoded file in the PCM cache
+static std::shared_ptr<const AudioFileData> Cache(const std::string& filename, 
+    std::shared_ptr<const AudioFileData> data, int rate) 
+{
+    if (data && data->ready() == data->frames) {
+        const void* buffer = data->storage == SAMPLE_F32 
+            ? static_cast<const void*>(data->samples.data()) : data->compact.data();
+        PcmCache::Store(filename, buffer, data->storage, data->nChannels, data->sampleRate, 
+            data->frames, GUARD_FRAMES, rate);
+    }
+    return data;
+}
+
+static bool OverBudget(long long totalFrames, int channels, int storage) {
+    return totalFrames * channels * static_cast<long long>(Storage::bytes(storage)) > FileManager::memoryBudget
+        || (totalFrames + 2 * GUARD_FRAMES) * channels > INT_MAX;
+}
+
+std::shared_ptr<const AudioFileData> FileManager::LoadAudioFile(std::string filename, 
+    const SampleStartCallback& onStart, int storage, int rate) 
+{
+    std::string ext = std::filesystem::path(filename).extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower); // Normalize extension
+
+    if (ext == ".wav") {
+        auto wav = std::make_unique<WavSource>(filename);
+        if (!wav->opened) {
+            std::cerr << "Failed to open WAV file: " << filename << std::endl;
+            return nullptr;
+        }
+        long long frames = wav->wav.totalPCMFrameCount;
+        int channels = wav->wav.channels, sampleRate = wav->wav.sampleRate;
+        std::unique_ptr<PageSource> source = std::move(wav);
+        SourceOpener reopen = [&]() -> std::unique_ptr<PageSource> {
+            auto more = std::make_unique<WavSource>(filename);
+            return more->opened ? std::move(more) : nullptr;
+        };
+        Resample(source, reopen, frames, channels, sampleRate, rate);
+        if (frames > 0 && OverBudget(frames, channels, storage))
+            return Page(filename, std::move(source), reopen, frames, channels, sampleRate, onStart);
+        return Decode(filename, "WAV", std::move(source), reopen, frames, channels, sampleRate, storage, 
+            onStart);
+    }
+    // compressed files are decoded once, then mapped from the cache
+    if (ext == ".flac" || ext == ".mp3") {
+        if (auto cached = PcmCache::Find(filename, GUARD_FRAMES, storage, rate)) {
+            auto data = std::make_shared<AudioFileData>(std::move(cached));
+            const bool peaksCached = StartPeaks(filename, *data);
+            if (onStart)
+                onStart(data);
+            AddPeaks(*data, 0, data->frames);
+            StorePeaks(filename, *data, peaksCached);
+            return data;
+        }
+    }
+    if (ext == ".flac") {
+        drflac* flac = drflac_open_file(filename.c_str(), NULL);
+        if (flac == NULL) {
+            std::cerr << "Failed to open FLAC file: " << filename << std::endl;
+            return nullptr;
+        }
+        std::unique_ptr<PageSource> source = std::make_unique<FlacSource>(flac);
+        long long frames = flac->totalPCMFrameCount;
+        int channels = flac->channels, sampleRate = flac->sampleRate;
+        SourceOpener reopen = [&]() -> std::unique_ptr<PageSource> {
+            drflac* more = drflac_open_file(filename.c_str(), NULL);
+            return more ? std::make_unique<FlacSource>(more) : nullptr;
+        };
+        Resample(source, reopen, frames, channels, sampleRate, rate);
+        if (frames > 0 && OverBudget(frames, channels, storage))
+            return Page(filename, std::move(source), reopen, frames, channels, sampleRate, onStart);
+        return Cache(filename, Decode(filename, "FLAC", std::move(source), reopen, frames, channels, 
+            sampleRate, storage, onStart), rate);
+    }
+    if (ext == ".mp3") {
+        auto mp3 = std::make_unique<Mp3Source>(filename);
+        if (!mp3->opened) {
+            std::cerr << "Failed to open MP3 file: " << filename << std::endl;
+            return nullptr;
         }
-        std::vector<float> samples {pSampleData, pSampleData + channels * totalPCMFrameCount};
-        AudioFileData data(samples, channels, sampleRate);
-        drwav_free(pSampleData, NULL);
-        return data;
-    }
-    else if (filename.ends_with(".flac")) {
-        // Read FLAC
-        unsigned int channels;
-        unsigned int sampleRate;
-        drflac_uint64 totalPCMFrameCount;
-        float* pSampleData = drflac_open_file_and_read_pcm_frames_f32(filename.c_str(), &channels, &sampleRate, &totalPCMFrameCount, NULL);
-        if (pSampleData == NULL) {
-            std::cerr << "Failed to open and decode FLAC file: " << filename << std::endl;
-            return {};
+        // MP3 has no length in its header, counting the frames skips synthesis
+        // and is much cheaper than growing the buffer while decoding
+        long long frames = drmp3_get_pcm_frame_count(&mp3->mp3);
+        if (!drmp3_seek_to_pcm_frame(&mp3->mp3, 0)) {
+            std::cerr << "Failed to decode MP3 file: " << filename << std::endl;
+            return nullptr;
         }
-        std::vector<float> samples {pSampleData, pSampleData + channels * totalPCMFrameCount};
-        AudioFileData data(samples, channels, sampleRate);
-        drflac_free(pSampleData, NULL);
-        return data;
-    }
-    else if (filename.ends_with(".mp3")) {
-        // Read MP3
-        drmp3_config conf;
-        drmp3_uint64 totalPCMFrameCount;
-        float* pSampleData = drmp3_open_file_and_read_pcm_frames_f32(filename.c_str(), &conf, &totalPCMFrameCount, NULL);
-        if (pSampleData == NULL) {
-            std::cerr << "Failed to open and decode MP3 file: " << filename << std::endl;
-            return {};
+        int channels = mp3->mp3.channels, sampleRate = mp3->mp3.sampleRate;
+        std::unique_ptr<PageSource> source = std::move(mp3);
+        SourceOpener reopen;
+        Resample(source, reopen, frames, channels, sampleRate, rate);
+        if (OverBudget(frames, channels, storage)) {
+            std::cerr << "MP3 file is too long to load, convert it to WAV or FLAC to stream it: " 
+                << filename << std::endl;
+            return nullptr;
         }
-        std::vector<float> samples {pSampleData, pSampleData + conf.channels * totalPCMFrameCount};
-        AudioFileData data(samples, conf.channels, conf.sampleRate);
-        drmp3_free(pSampleData, NULL);
-        return data;
+        return Cache(filename, Decode(filename, "MP3", std::move(source), {}, frames, channels, 
+            sampleRate, storage, onStart), rate);
     }
 
     // Unsupported format
     std::cerr << "Unsupported audio format: " << filename << std::endl;
-    return {};
-}
\ No newline at end of file
+    return nullptr;
+}
@@ -2,154 +2,340 @@
 Objects and functions relating to grains */
 
 #include <iostream>
+#include <cmath>
+#include <random>
 
 #include "granular.h"
+#include "kernels.h"
 
-// Hermite polynomial interpolation from https://stackoverflow.com/questions/1125666/how-do-you-do-bicubic-or-other-non-linear-interpolation-of-re-sampled-audio-da
-static float Interpolate4(float x0, float x1, float x2, float x3, float t) {
-	float c0 = x1;
-	float c1 = .5F * (x2 - x0);
-	float c2 = x0 - (2.5F * x1) + (2 * x2) - (.5F * x3);
-	float c3 = (.5F * (x3 - x0)) + (1.5F * (x1 - x2));
-	return (((((c3 * t) + c2) * t) + c1) * t) + c0;
-}
-
-// -- Grain class defs --
-Grain::Grain(AudioFileData* audioData) 
-    : data(audioData), start(0), size(0), index(0.0f), interval(0.0f),
-      pan(0.5f), envelope(0.0f), isPlaying(false) {}
+// -- Grain pool defs --
+GrainPool::GrainPool(int numGrains, const AudioFileData* audioData) 
+    : data(audioData), 
+      capacity((numGrains + GRAIN_LANES - 1) / GRAIN_LANES * GRAIN_LANES),
+      start(capacity, 0), playing(capacity, 0), remaining(capacity, 0),
+      window(capacity, 0), phase(capacity, 0), phaseInc(capacity, 0),
+      played(capacity, 0), origin(capacity, 0.0f), span(capacity, 0.0f), interval(capacity, 0.0f), 
+      pan(capacity, 0.5f) {}
 
-void Grain::outputStereo(float& l, float& r) {
-    if (!isPlaying || !data || index / abs(interval) >= size || (start + size) * 2 >= data->size || index < 0) {
-        isPlaying = false;
-        return;
+bool GrainPool::trigger(double position, int grainLength, float grainPan, float pitch, bool reverse, int shape, float elapsed) {
+    if (!data)
+        return false;
+    // frames still decoding are out of reach, along with the frames the
+    // interpolation taps would read past the last one
+    long long limit = data->ready();
+    if (limit < data->frames)
+        limit -= GUARD_FRAMES;
+    bool valid = grainLength > 0 && position >= 0 && position + grainLength * pitch <= limit;
+    if (!valid)
+        return false;
+    if (active == capacity) {
+        dropped++;
+        return false;
+    }
+    long long frame = static_cast<long long>(position);
+    float frac = position - frame;
+    // paged data is read from the slot its page sits in, which holds up to
+    // PAGE_OVERLAP frames past the grain's start
+    int first = static_cast<int>(frame);
+    if (data->pages && frac + grainLength * pitch > PAGE_OVERLAP) {
+        tooLong++;
+        return false;
     }
-    // hann window
-    envelope = cosf(2.0f * M_PI * (index / abs(interval) / size) + M_PI) / 2.0f + 0.5f;
-    int n = static_cast<int>(start + index) * 2;
-    float t = index - floor(index);
-    std::vector<float> p = get4Points(n);
-    l += Interpolate4(p[0], p[1], p[2], p[3], t)
-        * envelope
-        * (1.0f - pan);
-    p = get4Points(n+1);
-    r += Interpolate4(p[0], p[1], p[2], p[3], t)
-        * envelope
-        * pan;
-    index += interval;
-}
-
-void Grain::trigger(int grainStart, int grainLength, float grainPan, float pitch, bool reverse) {
-    size = grainLength;
-    pan = grainPan;
+    if (data->pages && !data->pages->pin(frame, frac + grainLength * pitch, first)) {
+        missed++;
+        return false;
+    }
+    int i = active++;
+    start[i] = first;
+    pan[i] = grainPan;
+    remaining[i] = grainLength;
+    window[i] = Window::offset(shape);
+    phaseInc[i] = Window::phaseIncrement(grainLength);
+    phase[i] = elapsed * phaseInc[i];
+    played[i] = 0;
+    // the range checked above, reads are held inside it
+    span[i] = frac + grainLength * pitch;
+    // reverse grains read the same span as forward ones, last to first
     if (reverse) {
-        start = grainStart + grainLength - 1;
-        interval = -pitch;
-        index = grainLength - 1;
+        interval[i] = -pitch;
+        origin[i] = frac + (grainLength - elapsed) * pitch;
     } else {
-        start = grainStart;
-        interval = pitch;
-        index = 0;
+        interval[i] = pitch;
+        origin[i] = frac + elapsed * pitch;
     }
-    isPlaying = true;
-    // for debug:
-    //std::cout << "Grain " << i << " triggered at " << s << std::endl;
-}
-
-std::vector<float> Grain::get4Points(int n) {
-    int s = data->nChannels; // get number of sample points per frame
-    int indexes[] = {n-s, n, n+s, n+(s*2)};
-    std::vector<float> points(4);
-    for (size_t i = 0; i < 4; i++) {
-        if (indexes[i] < 0 || indexes[i] > data->size)
-            points[i] = 0;
-        else 
-            points[i] = data->samples[indexes[i]];
+    playing[i] = -1;
+    return true;
+}
+
+void GrainPool::render(float* out, int nFrames) {
+    if (!data || active == 0)
+        return;
+    int nGrains = (active + GRAIN_LANES - 1) / GRAIN_LANES * GRAIN_LANES;
+    Kernels::renderGrains(*this, nGrains, out, nFrames);
+    // move the last playing grain into each slot freed during the block
+    for (int i = 0; i < active;) {
+        if (playing[i]) {
+            i++;
+            continue;
+        }
+        if (data->pages)
+            data->pages->unpin(start[i]);
+        int last = --active;
+        start[i] = start[last];
+        playing[i] = playing[last];
+        remaining[i] = remaining[last];
+        window[i] = window[last];
+        phase[i] = phase[last];
+        phaseInc[i] = phaseInc[last];
+        played[i] = played[last];
+        origin[i] = origin[last];
+        span[i] = span[last];
+        interval[i] = interval[last];
+        pan[i] = pan[last];
+        playing[last] = 0;
+    }
+}
+
+void GrainPool::clear() {
+    if (data && data->pages) {
+        for (int i = 0; i < active; i++)
+            data->pages->unpin(start[i]);
     }
-    return points;
+    std::fill(playing.begin(), playing.begin() + active, 0);
+    active = 0;
 }
 
 // -- Granular engine class defs --
-GranularEngine::GranularEngine(AudioFileData& audiodata) 
-    :   audioSize(audiodata.size), grains(MAX_GRAINS, &audiodata), 
-        index(0), Hs(6000), Ha(3000), density(2), semitones(0), cents(0), 
-        revprob(0), size(0.6f), stretch(2.0f), jitterAmount(0.0f), 
-        randomPanAmt(0.0f), spread(0.0f), pitch(1.0f)
+GranularEngine::GranularEngine(const AudioFileData* audiodata, const GranularParams& params, int poolSize) 
+    :   audioFrames(audiodata ? audiodata->frames : 0), fadeGrains(poolSize),
+        fadeBuffer(FADE_CHUNK_FRAMES * 2), grains(poolSize, audiodata), 
+        index(0), density(0), rate(0)
 {
+    events.reserve(MAX_DENSITY);
+    setParameters(params, true);
     std::random_device rd;
-    gen = std::mt19937(rd());
-    distrib = std::uniform_int_distribution<>(1,100);
-    std::cout << "Granular engine created" << std::endl;
-}
-
-void GranularEngine::playback(float& l, float& r) {
-    for (int i = 0; i < density; i++) {
-        // ensure jitter doesn't cause the index to be < 0
-        if (index % Hs == std::min(Hs-1, std::max(0, i * Hs / density + jitOffset))) {
-            if (jitterAmount > 0) {
-                // can shift trigger time up to Hs/2 frames early or late 
-                jitOffset = (Hs / -2.0f + distrib(gen) / 100.0f * Hs) * jitterAmount;
-            } else {
-                jitOffset = 0;
-            }
-            float pan = 0.5f;
-            if (randomPanAmt > 0)
-                pan += (distrib(gen) / 100.0f - 0.5f) * randomPanAmt;
-            int spreadOffset = 0;
-            if (spread >= 0.0004f)
-                spreadOffset = spread * (distrib(gen) * audioSize / 100.0f);
-            if (!grains[i].isPlaying) {
-                grains[i].trigger(
-                    index / Hs * Ha + 1.0f * Ha / density * i + spreadOffset, 
-                    1.0f * size * Hs - jitOffset, 
-                    pan,
-                    pitch,
-                    distrib(gen) < revprob
-                );
-            }
-            // debug
-            /* std::cout << "Grain " << i << " triggered at " 
-                << std::max(0, i * Hs / density + jitOffset) << std::endl; */
+    random.seed((uint64_t)rd() << 32 | rd());
+}
+
+void GranularEngine::setSample(const AudioFileData* audiodata, int fadeOutFrames) {
+    // a fade still in progress is cut short, its data is free right away
+    stopFade();
+    if (fadeOutFrames > 0 && grains.active > 0) {
+        // the vectors are swapped, not copied
+        std::swap(grains, fadeGrains);
+        fadeFrames = fadeLength = fadeOutFrames;
+    } else if (grains.data) {
+        released[nReleased++] = grains.data;
+    }
+    grains.clear();
+    report({static_cast<double>(clock), 0.0, 0, 0.0f, 0.0f, GRAIN_STOPPED, 0, false});
+    grains.data = audiodata;
+    audioFrames = audiodata ? audiodata->frames : 0;
+    seek(0);
+}
+
+void GranularEngine::stopFade() {
+    if (!fadeGrains.data)
+        return;
+    fadeGrains.clear();
+    released[nReleased++] = fadeGrains.data;
+    fadeGrains.data = nullptr;
+    fadeFrames = 0;
+}
+
+const AudioFileData* GranularEngine::takeReleased() {
+    return nReleased > 0 ? released[--nReleased] : nullptr;
+}
+
+void GranularEngine::renderFade(float* out, int nFrames) {
+    for (int pos = 0; pos < nFrames && fadeFrames > 0; pos += FADE_CHUNK_FRAMES) {
+        int n = std::min({nFrames - pos, FADE_CHUNK_FRAMES, fadeFrames});
+        std::fill(fadeBuffer.begin(), fadeBuffer.begin() + n * 2, 0.0f);
+        fadeGrains.render(fadeBuffer.data(), n);
+        // linear ramp from full level down to silence
+        float gain = (float)fadeFrames / fadeLength;
+        float step = 1.0f / fadeLength;
+        for (int j = 0; j < n; j++) {
+            out[(pos + j) * 2] += fadeBuffer[j * 2] * gain;
+            out[(pos + j) * 2 + 1] += fadeBuffer[j * 2 + 1] * gain;
+            gain -= step;
         }
-        if (grains[i].isPlaying)
-            grains[i].outputStereo(l, r);
+        fadeFrames -= n;
     }
-    index++;
+    if (fadeFrames == 0)
+        stopFade();
 }
 
-void GranularEngine::updateParameters(float newSize, float newStretch, int newDensity, int newHa, int newSemitones, int newCents) {
-    if (newSize > 0)
-        size = newSize;
-    if (newStretch > 0) {
-        stretch = newStretch;
-        //Hs = BASE_HS * stretch;
-        //Ha = Hs / stretch;
-        Hs = Ha * stretch;
+void GranularEngine::spawnGrain(double position, int grainLength, float elapsed) {
+    const float panDraw = draw(), spreadDraw = draw(), reverseDraw = draw();
+    float pan = 0.5f;
+    if (randomPanAmt > 0)
+        pan += (panDraw - 0.5f) * randomPanAmt;
+    long long spreadOffset = 0;
+    if (spread >= 0.0004f)
+        spreadOffset = spread * spreadDraw * audioFrames;
+    bool reverse = reverseDraw * 100 < revprob;
+    if (grains.trigger(position + spreadOffset, grainLength, pan, pitch, reverse, window, elapsed)) {
+        report({static_cast<double>(clock) - elapsed, position + spreadOffset, grainLength, pitch, pan, 
+            GRAIN_STARTED, static_cast<uint8_t>(window), reverse});
     }
-    if (newDensity > 0) {
-        for (int i = std::min(density, newDensity); i < std::max(density, newDensity); i++) {
-            grains[i].isPlaying = false;
-        }
-        density = newDensity;
-        /* -- for debug: --
-        int n = 0;
-        for (auto g : grains) {
-            std::cout << "Grain " << n;
-            g.isPlaying ? std::cout << " isPlaying = true" << std::endl
-                : std::cout << " isPlaying = false" << std::endl;
-            n++;
-        } */
+}
+
+// Later events sort first, making the heap a min-heap on time
+static bool later(const TriggerEvent& a, const TriggerEvent& b) {
+    return a.time > b.time;
+}
+
+void GranularEngine::schedule() {
+    period = currentPeriod();
+    events.clear();
+    for (int i = 0; i < streams(); i++) {
+        double nominal = gridOrigin + i * period / streams();
+        if (nominal < index)
+            nominal += ceil((index - nominal) / period) * period;
+        events.push_back({nominal, nominal, i});
     }
-    if (newHa > 0) {
-        Ha = newHa;
-        Hs = Ha * stretch;
+    std::make_heap(events.begin(), events.end(), later);
+}
+
+void GranularEngine::retime() {
+    double newPeriod = currentPeriod();
+    if (newPeriod == period)
+        return;
+    // scaling every distance by the same factor keeps the heap order
+    double ratio = newPeriod / period;
+    for (TriggerEvent& e : events) {
+        e.time = index + (e.time - index) * ratio;
+        e.nominal = index + (e.nominal - index) * ratio;
     }
-    if (newSemitones >= -24 && newSemitones <= 24) {
-        semitones = newSemitones;
-        pitch = 1.0f / pow(2.0f, -semitones / 12.0f) * pow(2.0f, cents / 1200.0f);
+    gridOrigin = index + (gridOrigin - index) * ratio;
+    period = newPeriod;
+}
+
+void GranularEngine::fire() {
+    std::pop_heap(events.begin(), events.end(), later);
+    TriggerEvent& e = events.back();
+    // the onset lies within the frame before index, possibly right on it
+    float elapsed = std::clamp(index - e.time, 0.0, 0.999);
+    // the nominal onset maps to the read position, jitter only moves timing
+    spawnGrain(e.nominal * Ha / Hs, 1.0f * size * Hs, elapsed);
+    if (e.stream == 0)
+        gridOrigin = e.nominal;
+    double fired = e.time;
+    e.nominal += period;
+    e.time = e.nominal;
+    // jitter moves an onset up to half a period early or late
+    if (jitterAmount > 0)
+        e.time += (random.uniformDouble() - 0.5) * period * jitterAmount;
+    e.time = std::max(e.time, fired);
+    std::push_heap(events.begin(), events.end(), later);
+}
+
+void GranularEngine::seek(long long newIndex) {
+    index = newIndex;
+    gridOrigin = newIndex;
+    schedule();
+}
+
+void GranularEngine::processBlock(float* out, int nFrames) {
+    if (fadeGrains.data)
+        renderFade(out, nFrames);
+    int pos = 0;
+    while (pos < nFrames) {
+        // start every grain whose onset falls up to the current frame
+        while (events.front().time <= index)
+            fire();
+        // no onset before the next event, so every grain can be rendered up
+        // to it in one go
+        int n = std::min<double>(nFrames - pos, ceil(events.front().time) - index);
+        grains.render(out + pos * 2, n);
+        index += n;
+        clock += n;
+        pos += n;
     }
-    if (newCents >= -100 && newCents <= 100) {
-        cents = newCents;
-        pitch = 1.0f / pow(2.0f, -semitones / 12.0f) * pow(2.0f, cents / 1200.0f);
+    report({static_cast<double>(clock), 0.0, 0, 0.0f, 0.0f, GRAIN_CLOCK, 0, false});
+}
+
+bool GranularEngine::playRegion(float* out, int nFrames, float start, float end, bool loop) {
+    const long long frames = grains.data ? grains.data->frames : 0;
+    // while the file is decoding, play up to the part that is ready
+    const long long ready = grains.data ? grains.data->ready() : 0;
+    const double endPoint = std::min<double>(1.0 * end * frames, ready) * stretch;
+    const long long startPoint = 1.0 * start * frames * stretch;
+    const float grainReach = size * Ha;
+    if (ready < frames && startPoint + grainReach >= endPoint) {
+        // nothing to granulate yet, wait for the decoder to reach the region
+        if (fadeGrains.data)
+            renderFade(out, nFrames);
+        grains.render(out, nFrames);
+        clock += nFrames;
+        report({static_cast<double>(clock), 0.0, 0, 0.0f, 0.0f, GRAIN_CLOCK, 0, false});
+        return true;
+    }
+    if (index < startPoint)
+        seek(startPoint);
+    int pos = 0;
+    bool playing = true;
+    while (pos < nFrames) {
+        // render up to the frame where the index reaches the end point
+        long long untilEnd = static_cast<long long>(ceil(endPoint - grainReach)) - index;
+        int n = std::clamp<long long>(untilEnd, 1, nFrames - pos);
+        processBlock(out + pos * 2, n);
+        pos += n;
+        // Handles looping
+        if (index + grainReach >= endPoint) {
+            seek(startPoint);
+            if (!loop) {
+                playing = false;
+                break;
+            }
+        }
+    }
+    // the page cache follows the read position and keeps the loop start warm
+    if (grains.data && grains.data->pages)
+        grains.data->pages->setCursor(cursor, index * Ha / Hs, 1.0 * start * frames);
+    return playing;
+}
+
+// Moves value a step closer to target, snapping once the difference is inaudible
+static void glide(float& value, float target) {
+    value += (target - value) * PARAM_SMOOTHING;
+    if (fabsf(target - value) <= 1e-5f * std::max(1.0f, fabsf(target)))
+        value = target;
+}
+
+void GranularEngine::setParameters(const GranularParams& params, bool jump) {
+    int newDensity = std::clamp(params.density, 1, MAX_DENSITY);
+    bool regrid = events.empty() || newDensity != density 
+        || (params.rate > 0) != (rate > 0);
+    target = params;
+    Ha = params.Ha;
+    density = newDensity;
+    rate = params.rate;
+    revprob = params.revprob;
+    window = params.window;
+    if (jump) {
+        size = params.size;
+        stretch = params.stretch;
+        jitterAmount = params.jitterAmount;
+        randomPanAmt = params.randomPanAmt;
+        spread = params.spread;
+        pitch = params.pitch();
     }
-}
\ No newline at end of file
+    Hs = std::max(1, static_cast<int>(Ha * stretch));
+    if (regrid)
+        schedule();
+    else
+        retime();
+}
+
+void GranularEngine::smoothParameters() {
+    glide(size, target.size);
+    glide(stretch, target.stretch);
+    glide(jitterAmount, target.jitterAmount);
+    glide(randomPanAmt, target.randomPanAmt);
+    glide(spread, target.spread);
+    glide(pitch, target.pitch());
+    Hs = std::max(1, static_cast<int>(Ha * stretch));
+    retime();
+}
@@ -2,6 +2,8 @@
 Contains GUI window to be rendered in main loop */
 
 #include <iostream>
+#include <algorithm>
+#include <cmath>
 
 #include "imgui-knobs.h"
 
@@ -17,9 +19,59 @@ Contains GUI window to be rendered in main loop */
 // knob speeds for coarse and fine tuning
 #define FAST (0.0f)
 #define SLOW (0.0003f)
+// Most grain playheads drawn over the waveform
+#define MAX_PLAYHEADS (128)
+// Waveform zoom per mouse wheel step, and pan per horizontal step as a
+// fraction of the view
+#define ZOOM_STEP (0.8)
+#define PAN_STEP (0.1)
+// Columns per frame when zoomed in all the way
+#define MIN_VIEW_COLUMNS (8)
+// Where the debug panel saves the audio callback profile
+#define PROFILE_FILE "glaive-profile.csv"
 
 static bool debug = false;
 
+// Zoomed part of the waveform, as fractions of the sample
+static double viewStart = 0.0, viewEnd = 1.0;
+static const AudioFileData* viewed = nullptr; // sample the view was set for
+// Waveform columns, kept between frames
+static std::vector<float> columnMins, columnMaxs;
+
+// Lowest and highest sample of frames [first, last), read from the samples
+// when zoomed in past the finest peaks
+static Peak columnPeak(const AudioFileData& sample, long long first, long long last) {
+    if (sample.pages || last - first >= PEAK_BASE_FRAMES)
+        return sample.peaks ? sample.peaks->range(first, last) : Peak();
+    Peak p;
+    last = std::min(last, sample.ready());
+    for (long long i = first * sample.nChannels; i < last * sample.nChannels; i++) {
+        float s = sample.sample(i);
+        p.min = std::min(p.min, s);
+        p.max = std::max(p.max, s);
+    }
+    return p;
+}
+
+// Grains of the transport that are still playing, rebuilt from its grain
+// events, and the time they played up to
+static std::vector<GrainEvent> grainsShown;
+static double grainClock = 0.0;
+
+// Picks up the grain events sent since the last frame
+static void updateGrains(GrainEventQueue& events) {
+    GrainEvent e;
+    while (events.pop(e)) {
+        if (e.type == GRAIN_STARTED)
+            grainsShown.push_back(e);
+        else if (e.type == GRAIN_CLOCK)
+            grainClock = e.time;
+        else if (e.type == GRAIN_STOPPED)
+            grainsShown.clear();
+    }
+    std::erase_if(grainsShown, [](const GrainEvent& g) { return grainClock >= g.end(); });
+}
+
 void renderGUI(AudioEngine& audioEngine) {
     // Toggle fine tuning knobs
     float knobSpeed = FAST;
@@ -33,7 +85,13 @@ void renderGUI(AudioEngine& audioEngine) {
         ImGuiWindowFlags_NoCollapse | ImGuiWindowFlags_NoMove | 
         ImGuiWindowFlags_NoTitleBar);
 
-    if (FileManager::fileLoaded){
+    AudioParams& params = audioEngine.params;
+    GranularParams& gran = audioEngine.params.granular;
+
+    // keeps the displayed sample alive for the whole frame
+    std::shared_ptr<const AudioFileData> sample = audioEngine.sample();
+
+    if (FileManager::fileLoaded && sample){
         ImVec2 scopeSize = ImVec2(ImGui::GetContentRegionAvail().x,100);
 
         // get window padding
@@ -44,59 +102,110 @@ void renderGUI(AudioEngine& audioEngine) {
 
         ImGui::PushID(0);
         ImVec2 plotPos = ImGui::GetCursorScreenPos();
+        // a new sample starts zoomed out
+        if (sample.get() != viewed) {
+            viewed = sample.get();
+            viewStart = 0.0;
+            viewEnd = 1.0;
+        }
+        const double viewLength = viewEnd - viewStart;
+        // view fraction to x on the scope
+        auto toScope = [&](double fraction) {
+            return static_cast<float>((fraction - viewStart) / viewLength * scopeSize.x);
+        };
         ImGui::SetNextItemAllowOverlap();
-        // render audio file waveform
-        Widgets::PlotLines(
-            "##audio", 
-            audioEngine.audioData.samples.data(), 
-            audioEngine.audioData.samples.size(), 
-            0, nullptr, -1.0f, 1.0f, scopeSize
-        );
-        // Render playheads for each grain currently playing
-        for (int i = 0; i < audioEngine.granEng.density; i++) {
-            Grain& g = audioEngine.granEng.grains[i];
+        // render audio file waveform, a column at a time from the peaks, so it
+        // takes the same time whatever the length of the file. Only the frames
+        // loaded so far are drawn
+        const int columns = std::max(1, static_cast<int>(scopeSize.x));
+        columnMins.resize(columns);
+        columnMaxs.resize(columns);
+        for (int x = 0; x < columns; x++) {
+            long long first = static_cast<long long>((viewStart + viewLength * x / columns) * sample->frames);
+            long long last = static_cast<long long>((viewStart + viewLength * (x + 1) / columns) * sample->frames);
+            Peak p = columnPeak(*sample, first, std::max(last, first + 1));
+            columnMins[x] = p.min;
+            columnMaxs[x] = p.max;
+        }
+        Widgets::PlotPeaks("##audio", columnMins.data(), columnMaxs.data(), columns, scopeSize);
+        // mouse wheel zooms in and out around the pointer, horizontal
+        // scrolling (or shift + wheel) moves along the file
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetItemKeyOwner(ImGuiKey_MouseWheelY);
+            const ImGuiIO& io = ImGui::GetIO();
+            double length = viewLength;
+            if (io.MouseWheel != 0.0f) {
+                // down to a frame per MIN_VIEW_COLUMNS columns
+                double minLength = std::min(1.0, 1.0 * columns / MIN_VIEW_COLUMNS / sample->frames);
+                double at = viewStart + viewLength * (io.MousePos.x - plotPos.x) / scopeSize.x;
+                length = std::clamp(viewLength * std::pow(ZOOM_STEP, io.MouseWheel), minLength, 1.0);
+                viewStart = at - (at - viewStart) * length / viewLength;
+            }
+            viewStart -= io.MouseWheelH * PAN_STEP * length;
+            viewStart = std::clamp(viewStart, 0.0, 1.0 - length);
+            viewEnd = viewStart + length;
+        }
+        // Render playheads for the latest grains currently playing
+        updateGrains(audioEngine.grainEvents);
+        const float* windows = Window::tables();
+        int drawn = 0;
+        for (auto g = grainsShown.rbegin(); g != grainsShown.rend() && drawn < MAX_PLAYHEADS; ++g) {
+            double played = std::max(0.0, grainClock - g->time);
+            double frame = g->position + (g->reverse ? g->length - played : played) * g->pitch;
+            double fraction = frame / sample->frames;
+            if (fraction < viewStart || fraction > viewEnd)
+                continue;
+            uint32_t phase = static_cast<uint32_t>(
+                std::min(played * Window::phaseIncrement(g->length), 1.0 * UINT32_MAX));
             ImGui::SetCursorScreenPos(plotPos);
-            Widgets::Playhead(1.0f * g.getCurrentRelIndex() / audioEngine.audioData.frames, scopeSize, g.getEnvelope());
+            Widgets::Playhead(toScope(fraction) / scopeSize.x, scopeSize, 
+                Window::read(windows + Window::offset(g->window), phase));
+            drawn++;
         }
-        // render start and end points
-        ImGui::SetCursorScreenPos(ImVec2(plotPos.x+audioEngine.start*scopeSize.x, plotPos.y));
-        ImGui::Button("##start", ImVec2(2.5f, scopeSize.y));
-        if (ImGui::IsItemActive()) { // defines button behavior when clicked and dragged
-            audioEngine.start = std::min(
-                std::max(0.0f, (ImGui::GetIO().MousePos.x - padding) / scopeSize.x), 
-                audioEngine.end - 0.01f
-            );
-            int scaledStartPoint = audioEngine.start * audioEngine.audioData.frames * audioEngine.granEng.stretch;
-            if (audioEngine.granEng.index < scaledStartPoint) {
-                audioEngine.granEng.index = scaledStartPoint+1;
+        // decode progress, over the bottom of the waveform
+        const long long ready = sample->ready();
+        if (FileManager::loading && ready < sample->frames) {
+            ImGui::SetCursorScreenPos(ImVec2(plotPos.x, plotPos.y + scopeSize.y - 4.0f));
+            ImGui::ProgressBar(1.0f * ready / sample->frames, ImVec2(scopeSize.x, 4.0f), "");
+        }
+        // render start and end points, dragged within the view
+        auto dragged = [&]() {
+            return viewStart + viewLength * (ImGui::GetIO().MousePos.x - plotPos.x) / scopeSize.x;
+        };
+        if (params.start >= viewStart && params.start <= viewEnd) {
+            ImGui::SetCursorScreenPos(ImVec2(plotPos.x + toScope(params.start), plotPos.y));
+            ImGui::Button("##start", ImVec2(2.5f, scopeSize.y));
+            if (ImGui::IsItemActive()) { // defines button behavior when clicked and dragged
+                params.start = static_cast<float>(std::clamp(dragged(), viewStart, 
+                    std::max(viewStart, params.end - 0.01)));
+                ImGui::BeginTooltip();
+                ImGui::Text("Start: %f", params.start);
+                ImGui::EndTooltip();
+            } else if (ImGui::IsItemHovered(ImGuiHoveredFlags_ForTooltip)) {
+                ImGui::BeginTooltip();
+                ImGui::Text("Start: %f", params.start);
+                ImGui::EndTooltip();
             }
-            ImGui::BeginTooltip();
-            ImGui::Text("Start: %f", audioEngine.start);
-            ImGui::EndTooltip();
-        } else if (ImGui::IsItemHovered(ImGuiHoveredFlags_ForTooltip)) {
-            ImGui::BeginTooltip();
-            ImGui::Text("Start: %f", audioEngine.start);
-            ImGui::EndTooltip();
         }
         
-        ImGui::SetCursorScreenPos(ImVec2(plotPos.x+audioEngine.end*scopeSize.x, plotPos.y));
-        ImGui::Button("##end", ImVec2(2.5f, scopeSize.y));
-        if (ImGui::IsItemActive()) { // defines button behavior when clicked and dragged
-            audioEngine.end = std::min(
-                std::max(
-                    audioEngine.start + 0.01f, 
-                    (ImGui::GetIO().MousePos.x - padding) / scopeSize.x
-                ),
-                1.0f
-            );
-            ImGui::BeginTooltip();
-            ImGui::Text("End: %f", audioEngine.end);
-            ImGui::EndTooltip();
-        } else if (ImGui::IsItemHovered(ImGuiHoveredFlags_ForTooltip)) {
-            ImGui::BeginTooltip();
-            ImGui::Text("End: %f", audioEngine.end);
-            ImGui::EndTooltip();
+        if (params.end >= viewStart && params.end <= viewEnd) {
+            ImGui::SetCursorScreenPos(ImVec2(plotPos.x + toScope(params.end), plotPos.y));
+            ImGui::Button("##end", ImVec2(2.5f, scopeSize.y));
+            if (ImGui::IsItemActive()) { // defines button behavior when clicked and dragged
+                params.end = static_cast<float>(std::clamp(dragged(), 
+                    std::min(viewEnd, params.start + 0.01), viewEnd));
+                ImGui::BeginTooltip();
+                ImGui::Text("End: %f", params.end);
+                ImGui::EndTooltip();
+            } else if (ImGui::IsItemHovered(ImGuiHoveredFlags_ForTooltip)) {
+                ImGui::BeginTooltip();
+                ImGui::Text("End: %f", params.end);
+                ImGui::EndTooltip();
+            }
         }
+        // leaves the cursor below the scope whatever was drawn last
+        ImGui::SetCursorScreenPos(ImVec2(plotPos.x, plotPos.y + scopeSize.y));
+        ImGui::Dummy(ImVec2(0.0f, 0.0f));
         ImGui::PopID(); //0
 
         // Button or space bar to play/pause 
@@ -106,11 +215,22 @@ void renderGUI(AudioEngine& audioEngine) {
         ImGui::SameLine();
         if(ImGui::Button("Stop")) {
             audioEngine.granularPlaying.store(false);
-            audioEngine.granEng.index = audioEngine.start 
-                * audioEngine.audioData.frames * audioEngine.granEng.stretch;
+            audioEngine.rewind.store(true);
         }
         ImGui::SameLine();
-        Widgets::Checkbox("Loop", &audioEngine.loop);
+        Widgets::Checkbox("Loop", &params.loop);
+        ImGui::SameLine();
+        // Grain window shape
+        ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x);
+        if (ImGui::BeginCombo("##window", Window::name(gran.window))) {
+            for (int w = 0; w < WINDOW_SHAPES; w++) {
+                if (ImGui::Selectable(Window::name(w), gran.window == w))
+                    gran.window = w;
+            }
+            ImGui::EndCombo();
+        }
+        if (ImGui::IsItemHovered(ImGuiHoveredFlags_ForTooltip))
+            ImGui::SetTooltip("Grain window");
 
         // even knob spacing
         int knobsPerRow = 4;
@@ -120,74 +240,58 @@ void renderGUI(AudioEngine& audioEngine) {
 
         ImGui::SeparatorText("Granular parameters");
         // Knob for Grain Size (values between 1 and 2000)
-        if (ImGuiKnobs::Knob("Grain Size", &audioEngine.granEng.size, 0.1f, 0.999f, knobSpeed, "%.3f", ImGuiKnobVariant_Tick)) {
-            // Recalculate the granular engine parameters whenever the grain size is updated
-            audioEngine.granEng.updateParameters(audioEngine.granEng.size);
-        }
+        ImGuiKnobs::Knob("Grain Size", &gran.size, 0.1f, 0.999f, knobSpeed, "%.3f", ImGuiKnobVariant_Tick);
         if (ImGui::IsItemActive() && ImGui::IsMouseDoubleClicked(0)) { //double click to reset default
-            audioEngine.granEng.updateParameters(0.6f);
+            gran.size = 0.6f;
         }
         ImGui::SameLine();
         ImGui::SetCursorPosX(padding + spacing + knobWidth); // Position knob
         // Knob for Stretch Factor (values between 0.1 and 10.0)
-        if (ImGuiKnobs::Knob("Stretch", &audioEngine.granEng.stretch, 0.1f, 10.0f, knobSpeed, "%.3f", ImGuiKnobVariant_Tick)) {
-            // Recalculate the granular engine parameters whenever the stretch factor is updated
-            audioEngine.granEng.updateParameters(0, audioEngine.granEng.stretch);
-            int scaledStartPoint = audioEngine.start * audioEngine.audioData.frames * audioEngine.granEng.stretch;
-            if (audioEngine.granEng.index < scaledStartPoint) {
-                audioEngine.granEng.index = scaledStartPoint+1;
-            }
-        }
+        ImGuiKnobs::Knob("Stretch", &gran.stretch, 0.1f, 10.0f, knobSpeed, "%.3f", ImGuiKnobVariant_Tick);
         if (ImGui::IsItemActive() && ImGui::IsMouseDoubleClicked(0)) { //double click to reset default
-            audioEngine.granEng.updateParameters(0, 2.0f);
+            gran.stretch = 2.0f;
         }
         ImGui::SameLine();
         ImGui::SetCursorPosX(padding + 2 * (knobWidth + spacing)); // Position knob
         // Knob for Grain Density (values between 1 and 100)
-        if (ImGuiKnobs::KnobInt("Density", &audioEngine.granEng.density, 1, MAX_GRAINS, 0.0f, "%d", ImGuiKnobVariant_Stepped, 0.0f, 0, MAX_GRAINS)) {
-            // Recalculate the granular engine parameters whenever the grain density is updated
-            audioEngine.granEng.updateParameters(0,0,audioEngine.granEng.density);
-        }
+        ImGuiKnobs::KnobInt("Density", &gran.density, 1, MAX_DENSITY, 0.0f, "%d", ImGuiKnobVariant_Tick);
         if (ImGui::IsItemActive() && ImGui::IsMouseDoubleClicked(0)) { //double click to reset default
-            audioEngine.granEng.updateParameters(0,0,2);
+            gran.density = 2;
         }
         ImGui::SameLine();
         ImGui::SetCursorPosX(padding + 3 * (knobWidth + spacing)); // Position knob
         // Knob for analysis hopsize (automatically updates synthesis hopsize)
-        if (ImGuiKnobs::KnobInt("Hopsize", &audioEngine.granEng.Ha, 100, 8000, 0.0f, "%d", ImGuiKnobVariant_Tick)) {
-            // Recalculate the granular engine parameters whenever the grain size is updated
-            audioEngine.granEng.updateParameters(0,0,0,audioEngine.granEng.Ha);
-        }
+        ImGuiKnobs::KnobInt("Hopsize", &gran.Ha, 100, 8000, 0.0f, "%d", ImGuiKnobVariant_Tick);
         if (ImGui::IsItemActive() && ImGui::IsMouseDoubleClicked(0)) { //double click to reset default
-            audioEngine.granEng.updateParameters(0,0,0,3000);
+            gran.Ha = 3000;
         }
 
         ImGui::SeparatorText("Randomization parameters");
         // Jitter knob
-        ImGuiKnobs::Knob("Jitter", &audioEngine.granEng.jitterAmount, 0.0f, 1.0f, knobSpeed, "%.3f", ImGuiKnobVariant_Tick);
+        ImGuiKnobs::Knob("Jitter", &gran.jitterAmount, 0.0f, 1.0f, knobSpeed, "%.3f", ImGuiKnobVariant_Tick);
         if (ImGui::IsItemActive() && ImGui::IsMouseDoubleClicked(0)) { //double click to reset
-            audioEngine.granEng.jitterAmount = 0.0f;
+            gran.jitterAmount = 0.0f;
         }
         ImGui::SameLine();
         ImGui::SetCursorPosX(padding + spacing + knobWidth); // Position knob
         // Random pan knob
-        ImGuiKnobs::Knob("Pan", &audioEngine.granEng.randomPanAmt, 0.0f, 1.0f, knobSpeed, "%.3f", ImGuiKnobVariant_Tick);
+        ImGuiKnobs::Knob("Pan", &gran.randomPanAmt, 0.0f, 1.0f, knobSpeed, "%.3f", ImGuiKnobVariant_Tick);
         if (ImGui::IsItemActive() && ImGui::IsMouseDoubleClicked(0)) { //double click to reset
-            audioEngine.granEng.randomPanAmt = 0.0f;
+            gran.randomPanAmt = 0.0f;
         }
         ImGui::SameLine();
         ImGui::SetCursorPosX(padding + 2 * (spacing + knobWidth)); // Position knob
         // Spread knob
-        ImGuiKnobs::Knob("Spread", &audioEngine.granEng.spread, 0.0004f, 1.0f, knobSpeed, "%.3f", ImGuiKnobVariant_Tick, 0.0f, ImGuiKnobFlags_Logarithmic);
+        ImGuiKnobs::Knob("Spread", &gran.spread, 0.0004f, 1.0f, knobSpeed, "%.3f", ImGuiKnobVariant_Tick, 0.0f, ImGuiKnobFlags_Logarithmic);
         if (ImGui::IsItemActive() && ImGui::IsMouseDoubleClicked(0)) { //double click to reset
-            audioEngine.granEng.spread = 0.0f;
+            gran.spread = 0.0f;
         }
         ImGui::SameLine();
         ImGui::SetCursorPosX(padding + 3 * (spacing + knobWidth)); // Position knob
         // Reverse grain probability knob
-        ImGuiKnobs::KnobInt("Reverse Prob.", &audioEngine.granEng.revprob,0,100,0.0f,"%d%%",ImGuiKnobVariant_Tick);
+        ImGuiKnobs::KnobInt("Reverse Prob.", &gran.revprob,0,100,0.0f,"%d%%",ImGuiKnobVariant_Tick);
         if (ImGui::IsItemActive() && ImGui::IsMouseDoubleClicked(0)) { //double click to reset
-            audioEngine.granEng.revprob = 0;
+            gran.revprob = 0;
         }
 
         ImGui::BeginChild(
@@ -215,22 +319,16 @@ void renderGUI(AudioEngine& audioEngine) {
         ImGui::EndChild();
 
         // Knob for pitch in semitones
-        if (ImGuiKnobs::KnobInt("Semitones", &audioEngine.granEng.semitones, -24, 24, 0.0f, "%d", ImGuiKnobVariant_Stepped, 0.0f, 0, 13)) {
-            // Recalculates pitch when semitones changes
-            audioEngine.granEng.updateParameters(0,0,0,0,audioEngine.granEng.semitones);
-        }
+        ImGuiKnobs::KnobInt("Semitones", &gran.semitones, -24, 24, 0.0f, "%d", ImGuiKnobVariant_Stepped, 0.0f, 0, 13);
         if (ImGui::IsItemActive() && ImGui::IsMouseDoubleClicked(0)) { //double click to reset default
-            audioEngine.granEng.updateParameters(0,0,0,0,0);
+            gran.semitones = 0;
         }
         ImGui::SameLine();
         ImGui::SetCursorPosX(padding + spacing + knobWidth); // Position knob
         // Knob for cents (fine tuning)
-        if (ImGuiKnobs::KnobInt("Cents", &audioEngine.granEng.cents, -100, 100, 0.0f, "%d", ImGuiKnobVariant_Tick)) {
-            // Recalculates pitch when cents changes
-            audioEngine.granEng.updateParameters(0,0,0,0,25,audioEngine.granEng.cents);
-        }
+        ImGuiKnobs::KnobInt("Cents", &gran.cents, -100, 100, 0.0f, "%d", ImGuiKnobVariant_Tick);
         if (ImGui::IsItemActive() && ImGui::IsMouseDoubleClicked(0)) { //double click to reset default
-            audioEngine.granEng.updateParameters(0,0,0,0,25,0);
+            gran.cents = 0;
         }
         ImGui::SameLine();
 
@@ -239,14 +337,19 @@ void renderGUI(AudioEngine& audioEngine) {
         ImGui::SameLine();
         // Volume knob
         ImGui::SetCursorPosX(ImGui::GetWindowWidth()/2 + padding * 2);
-        float mVol = audioEngine.masterVolume.load();
-        if (ImGuiKnobs::Knob("Volume", &mVol, 0.0f, 1.0f, knobSpeed, "%.2f", ImGuiKnobVariant_Tick)) {
-            audioEngine.masterVolume.store(mVol);
+        ImGuiKnobs::Knob("Volume", &params.volume, 0.0f, 1.0f, knobSpeed, "%.2f", ImGuiKnobVariant_Tick);
+        if (ImGui::IsItemActive() && ImGui::IsMouseDoubleClicked(0)) { //double click to reset
+            params.volume = 1;
         }
+        ImGui::SameLine();
+        ImGui::SetCursorPosX(padding + 3 * (spacing + knobWidth)); // Position knob
+        // Grains per second knob, 0 triggers by density instead
+        ImGuiKnobs::Knob("Grains/s", &gran.rate, 1.0f, 5000.0f, knobSpeed, "%.0f", ImGuiKnobVariant_Tick, 0.0f, ImGuiKnobFlags_Logarithmic);
         if (ImGui::IsItemActive() && ImGui::IsMouseDoubleClicked(0)) { //double click to reset
-            mVol = 1;
-            audioEngine.masterVolume.store(mVol);
+            gran.rate = 0.0f;
         }
+        if (ImGui::IsItemHovered(ImGuiHoveredFlags_ForTooltip))
+            ImGui::SetTooltip("Grains per second, replaces density when above 0.\nDouble click to turn off");
 
         // Display debug information
         if (ImGui::IsKeyPressed(ImGuiKey_D, false) && ImGui::IsKeyDown(ImGuiKey_LeftCtrl))
@@ -254,19 +357,68 @@ void renderGUI(AudioEngine& audioEngine) {
 
         if (debug) {
             ImGui::SeparatorText("Debug");
-            ImGui::Text("Current s. index: %d", audioEngine.granEng.index);
+            long long index = audioEngine.playIndex.load();
+            ImGui::Text("Current s. index: %lld", index);
             ImGui::Text(
-                "Current a. index: %d", 
-                static_cast<int>(1.0f * audioEngine.granEng.index / audioEngine.granEng.stretch)
+                "Current a. index: %lld", 
+                static_cast<long long>(index / gran.stretch)
             );
             ImGui::Text(
                 "Current grain size: %d", 
-                static_cast<int>(1.0f * audioEngine.granEng.Hs * audioEngine.granEng.size)
+                static_cast<int>(1.0f * gran.Hs() * gran.size)
             );
-            ImGui::Text("Current Ha: %d", audioEngine.granEng.Ha);
-            ImGui::Text("Current Hs: %d", audioEngine.granEng.Hs);
-            ImGui::Text("Current pitch: %.3f", audioEngine.granEng.pitch); 
-            ImGui::Text("Playback start: %f, end: %f", audioEngine.start, audioEngine.end);
+            ImGui::Text("Current Ha: %d", gran.Ha);
+            ImGui::Text("Current Hs: %d", gran.Hs());
+            ImGui::Text("Current pitch: %.3f", gran.pitch()); 
+            ImGui::Text(
+                "Grains playing: %d, dropped: %d, missed: %d, too long: %d", 
+                static_cast<int>(grainsShown.size()), audioEngine.grainsDropped.load(),
+                audioEngine.grainsMissed.load(), audioEngine.grainsTooLong.load()
+            );
+            if (sample->pages)
+                ImGui::Text("Pages: %d slots, %lld loaded", sample->pages->slots(), sample->pages->loads());
+            // storage of the files dropped from now on, compact formats take
+            // half the memory
+            ImGui::Text("Sample storage: %s, next file:", Storage::name(sample->storage));
+            ImGui::SameLine();
+            ImGui::SetNextItemWidth(60.0f);
+            if (ImGui::BeginCombo("##storage", Storage::name(FileManager::sampleStorage))) {
+                for (int s = 0; s < SAMPLE_STORAGES; s++) {
+                    if (ImGui::Selectable(Storage::name(s), FileManager::sampleStorage == s))
+                        FileManager::sampleStorage = s;
+                }
+                ImGui::EndCombo();
+            }
+            ImGui::Text("Voices playing: %d, sample fades cut short: %d", audioEngine.voicesPlaying.load(),
+                audioEngine.fadesCut.load());
+            ImGui::Text("Playback start: %f, end: %f", params.start, params.end);
+
+            // audio callback timing against the buffer deadline
+            Profiler& profiler = audioEngine.profiler;
+            Profiler::Stats stats = profiler.stats();
+            ImGui::Text(
+                "DSP load: %.1f%%, mean %.1f%%, p99 %.0f%%, p99.9 %.0f%%, max %.1f%%",
+                stats.load * 100, stats.meanLoad * 100, stats.p99 * 100, stats.p999 * 100,
+                stats.maxLoad * 100
+            );
+            ImGui::Text(
+                "Blocks: %lld, late: %lld, underflows: %lld, overflows: %lld",
+                stats.blocks, stats.late, stats.underflows, stats.overflows
+            );
+            ImGui::Text("Longest block: %.0f us, output latency: %.1f ms", 
+                stats.maxMicroseconds, stats.latencyMs);
+            static float loads[PROFILE_BUCKETS];
+            for (int b = 0; b < PROFILE_BUCKETS; b++)
+                loads[b] = static_cast<float>(profiler.bucket(b));
+            ImGui::PlotHistogram("##load", loads, PROFILE_BUCKETS, 0, "DSP load, 0 to 200%", 
+                0.0f, FLT_MAX, ImVec2(ImGui::GetContentRegionAvail().x, 40.0f));
+            if (ImGui::Button("Reset profile"))
+                profiler.reset();
+            ImGui::SameLine();
+            if (ImGui::Button("Save profile")) {
+                if (profiler.dump(PROFILE_FILE))
+                    std::cout << "Profile saved to " << PROFILE_FILE << std::endl;
+            }
         }
     } else {
         const char* text;
@@ -283,4 +435,6 @@ void renderGUI(AudioEngine& audioEngine) {
     }
 
     ImGui::End();
+
+    audioEngine.publishParams();
 }
\ No newline at end of file
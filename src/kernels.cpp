@@ -0,0 +1,375 @@
+/* kernels.cpp
+Grain rendering kernels. Each SIMD lane renders one grain: taps are fetched for
+all lanes, interpolated, windowed from the window tables and panned together, then the lanes are summed
+into the output frame. The scalar kernel is the reference and the fallback for
+CPUs without SSE2/AVX2. Every kernel is built for each sample storage format,
+compact samples are converted to float as the taps are fetched. Set
+GLAIVE_KERNEL=scalar|sse2|avx2 to force a kernel */
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+#include "kernels.h"
+#include "window.h"
+#include "storage.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KERNELS_X86
+#include <immintrin.h>
+#endif
+
+// Hermite polynomial interpolation from https://stackoverflow.com/questions/1125666/how-do-you-do-bicubic-or-other-non-linear-interpolation-of-re-sampled-audio-da
+static inline float Interpolate4(float x0, float x1, float x2, float x3, float t) {
+	float c0 = x1;
+	float c1 = .5F * (x2 - x0);
+	float c2 = x0 - (2.5F * x1) + (2 * x2) - (.5F * x3);
+	float c3 = (.5F * (x3 - x0)) + (1.5F * (x1 - x2));
+	return (((((c3 * t) + c2) * t) + c1) * t) + c0;
+}
+
+// Element type of each storage format and its conversion to float
+template <int S> struct Sample;
+template <> struct Sample<SAMPLE_F32> {
+    typedef float T;
+    static inline float load(float x) { return x; }
+};
+template <> struct Sample<SAMPLE_S16> {
+    typedef int16_t T;
+    static inline float load(int16_t x) { return Storage::fromS16(x); }
+};
+template <> struct Sample<SAMPLE_F16> {
+    typedef uint16_t T;
+    static inline float load(uint16_t x) { return Storage::fromF16(x); }
+};
+
+// -- Scalar kernel --
+template <int S>
+static void renderScalar(GrainPool& g, int nGrains, float* out, int nFrames) {
+    typedef Sample<S> L;
+    const int ch = g.data->nChannels;
+    const int right = ch > 1 ? 1 : 0; // mono sources feed both channels
+    const typename L::T* samples = static_cast<const typename L::T*>(g.data->raw());
+    const float* tables = Window::tables();
+    for (int k = 0; k < nGrains; k++) {
+        if (!g.playing[k])
+            continue;
+        const int start = g.start[k];
+        const float interval = g.interval[k];
+        const float panL = 1.0f - g.pan[k], panR = g.pan[k];
+        const float* window = tables + g.window[k];
+        const uint32_t phaseInc = g.phaseInc[k];
+        uint32_t phase = g.phase[k];
+        const float origin = g.origin[k], span = g.span[k];
+        const int played = g.played[k];
+        const int n = std::min(nFrames, g.remaining[k]);
+        for (int i = 0; i < n; i++) {
+            float env = Window::read(window, phase);
+            // from the frames played rather than summed up frame by frame, so
+            // rounding can't drift, and held in the range checked at trigger.
+            // Guard frames cover the outer taps
+            float index = std::min(std::max(origin + (played + i) * interval, 0.0f), span);
+            int i0 = static_cast<int>(index);
+            float t = index - i0;
+            const typename L::T* p = samples + (start + i0) * ch;
+            out[i*2] += Interpolate4(L::load(p[-ch]), L::load(p[0]), L::load(p[ch]), L::load(p[ch*2]), t) 
+                * env * panL;
+            p += right;
+            out[i*2+1] += Interpolate4(L::load(p[-ch]), L::load(p[0]), L::load(p[ch]), L::load(p[ch*2]), t) 
+                * env * panR;
+            phase += phaseInc;
+        }
+        g.played[k] = played + n;
+        g.phase[k] = phase;
+        g.remaining[k] -= n;
+        if (g.remaining[k] <= 0)
+            g.playing[k] = 0;
+    }
+}
+
+#ifdef KERNELS_X86
+// -- SSE2 kernel, 4 grains per step --
+__attribute__((target("sse2")))
+static inline __m128 interpolate4(__m128 x0, __m128 x1, __m128 x2, __m128 x3, __m128 t) {
+    const __m128 half = _mm_set1_ps(.5F);
+    __m128 c1 = _mm_mul_ps(half, _mm_sub_ps(x2, x0));
+    __m128 c2 = _mm_sub_ps(
+        _mm_add_ps(_mm_sub_ps(x0, _mm_mul_ps(_mm_set1_ps(2.5F), x1)), _mm_mul_ps(_mm_set1_ps(2.0F), x2)),
+        _mm_mul_ps(half, x3));
+    __m128 c3 = _mm_add_ps(_mm_mul_ps(half, _mm_sub_ps(x3, x0)), _mm_mul_ps(_mm_set1_ps(1.5F), _mm_sub_ps(x1, x2)));
+    __m128 r = _mm_add_ps(_mm_mul_ps(c3, t), c2);
+    r = _mm_add_ps(_mm_mul_ps(r, t), c1);
+    return _mm_add_ps(_mm_mul_ps(r, t), x1);
+}
+
+// One tap of four grains, read at offset from their frames
+template <int S>
+__attribute__((target("sse2")))
+static inline __m128 taps4(const typename Sample<S>::T* const p[4], int offset) {
+    typedef Sample<S> L;
+    return _mm_setr_ps(L::load(p[0][offset]), L::load(p[1][offset]), L::load(p[2][offset]), 
+        L::load(p[3][offset]));
+}
+
+template <int S>
+__attribute__((target("sse2")))
+static void renderSSE2(GrainPool& g, int nGrains, float* out, int nFrames) {
+    typedef typename Sample<S>::T T;
+    const int ch = g.data->nChannels;
+    const int right = ch > 1 ? 1 : 0;
+    const T* samples = static_cast<const T*>(g.data->raw());
+    const float* tables = Window::tables();
+    const __m128 one = _mm_set1_ps(1.0f), zero = _mm_setzero_ps();
+    const __m128i fracMask = _mm_set1_epi32((1u << WINDOW_FRAC_BITS) - 1);
+    const __m128 fracScale = _mm_set1_ps(1.0f / (1u << WINDOW_FRAC_BITS));
+    for (int k = 0; k < nGrains; k += 4) {
+        __m128i alive = _mm_loadu_si128((const __m128i*)&g.playing[k]);
+        if (_mm_movemask_epi8(alive) == 0)
+            continue;
+        const __m128i start = _mm_loadu_si128((const __m128i*)&g.start[k]);
+        const __m128i window = _mm_loadu_si128((const __m128i*)&g.window[k]);
+        const __m128i phaseInc = _mm_loadu_si128((const __m128i*)&g.phaseInc[k]);
+        const __m128 interval = _mm_loadu_ps(&g.interval[k]);
+        const __m128 origin = _mm_loadu_ps(&g.origin[k]);
+        const __m128 span = _mm_loadu_ps(&g.span[k]);
+        const __m128 panR = _mm_loadu_ps(&g.pan[k]);
+        const __m128 panL = _mm_sub_ps(one, panR);
+        __m128i remaining = _mm_loadu_si128((const __m128i*)&g.remaining[k]);
+        __m128i phase = _mm_loadu_si128((const __m128i*)&g.phase[k]);
+        const __m128i played = _mm_loadu_si128((const __m128i*)&g.played[k]);
+        __m128 count = _mm_cvtepi32_ps(played);
+        int i = 0;
+        for (; i < nFrames; i++) {
+            alive = _mm_and_si128(alive, _mm_cmpgt_epi32(remaining, _mm_setzero_si128()));
+            if (_mm_movemask_epi8(alive) == 0)
+                break;
+            // same position and clamp as the scalar kernel
+            __m128 index = _mm_add_ps(origin, _mm_mul_ps(count, interval));
+            index = _mm_min_ps(_mm_max_ps(index, zero), span);
+            __m128i i0 = _mm_cvttps_epi32(index);
+            __m128 t = _mm_sub_ps(index, _mm_cvtepi32_ps(i0));
+            // finished lanes read frame 0 so every tap stays inside the buffer
+            __m128i frame = _mm_and_si128(_mm_add_epi32(start, i0), alive);
+            __m128i w = _mm_add_epi32(window, _mm_srli_epi32(phase, WINDOW_FRAC_BITS));
+            __m128 wt = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(phase, fracMask)), fracScale);
+            alignas(16) int f[4], wi[4];
+            _mm_store_si128((__m128i*)f, frame);
+            _mm_store_si128((__m128i*)wi, w);
+            __m128 w0 = _mm_setr_ps(tables[wi[0]], tables[wi[1]], tables[wi[2]], tables[wi[3]]);
+            __m128 w1 = _mm_setr_ps(tables[wi[0]+1], tables[wi[1]+1], tables[wi[2]+1], tables[wi[3]+1]);
+            __m128 env = _mm_add_ps(w0, _mm_mul_ps(wt, _mm_sub_ps(w1, w0)));
+            env = _mm_and_ps(env, _mm_castsi128_ps(alive));
+            const T* p[4] = {samples + f[0] * ch, samples + f[1] * ch, samples + f[2] * ch, 
+                samples + f[3] * ch};
+            __m128 l = interpolate4(taps4<S>(p, -ch), taps4<S>(p, 0), taps4<S>(p, ch), 
+                taps4<S>(p, ch*2), t);
+            const T* pr[4] = {p[0] + right, p[1] + right, p[2] + right, p[3] + right};
+            __m128 r = interpolate4(taps4<S>(pr, -ch), taps4<S>(pr, 0), taps4<S>(pr, ch), 
+                taps4<S>(pr, ch*2), t);
+            l = _mm_mul_ps(_mm_mul_ps(l, env), panL);
+            r = _mm_mul_ps(_mm_mul_ps(r, env), panR);
+            // sum the lanes into [l, r, ., .]
+            __m128 s = _mm_add_ps(_mm_unpacklo_ps(l, r), _mm_unpackhi_ps(l, r));
+            s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+            __m128 o = _mm_loadl_pi(zero, (const __m64*)(out + i * 2));
+            _mm_storel_pi((__m64*)(out + i * 2), _mm_add_ps(o, s));
+            count = _mm_add_ps(count, one);
+            phase = _mm_add_epi32(phase, phaseInc);
+            remaining = _mm_add_epi32(remaining, alive); // alive lanes are -1
+        }
+        alive = _mm_and_si128(alive, _mm_cmpgt_epi32(remaining, _mm_setzero_si128()));
+        // lanes that ended count on past their end, but are freed
+        _mm_storeu_si128((__m128i*)&g.played[k], _mm_add_epi32(played, _mm_set1_epi32(i)));
+        _mm_storeu_si128((__m128i*)&g.phase[k], phase);
+        _mm_storeu_si128((__m128i*)&g.remaining[k], remaining);
+        _mm_storeu_si128((__m128i*)&g.playing[k], alive);
+    }
+}
+
+// -- AVX2 kernel, 8 grains per step --
+__attribute__((target("avx2")))
+static inline __m256 interpolate8(__m256 x0, __m256 x1, __m256 x2, __m256 x3, __m256 t) {
+    const __m256 half = _mm256_set1_ps(.5F);
+    __m256 c1 = _mm256_mul_ps(half, _mm256_sub_ps(x2, x0));
+    __m256 c2 = _mm256_sub_ps(
+        _mm256_add_ps(_mm256_sub_ps(x0, _mm256_mul_ps(_mm256_set1_ps(2.5F), x1)), _mm256_mul_ps(_mm256_set1_ps(2.0F), x2)),
+        _mm256_mul_ps(half, x3));
+    __m256 c3 = _mm256_add_ps(_mm256_mul_ps(half, _mm256_sub_ps(x3, x0)), _mm256_mul_ps(_mm256_set1_ps(1.5F), _mm256_sub_ps(x1, x2)));
+    __m256 r = _mm256_add_ps(_mm256_mul_ps(c3, t), c2);
+    r = _mm256_add_ps(_mm256_mul_ps(r, t), c1);
+    return _mm256_add_ps(_mm256_mul_ps(r, t), x1);
+}
+
+// One tap of eight grains at sample offsets off. Compact samples are gathered
+// as the 32 bits starting at each, the sample in the low half, which never
+// reads past the trailing guard frames
+template <int S> static inline __m256 gather8(const void* samples, __m256i off);
+
+template <>
+__attribute__((target("avx2")))
+inline __m256 gather8<SAMPLE_F32>(const void* samples, __m256i off) {
+    return _mm256_i32gather_ps(static_cast<const float*>(samples), off, 4);
+}
+
+template <>
+__attribute__((target("avx2")))
+inline __m256 gather8<SAMPLE_S16>(const void* samples, __m256i off) {
+    __m256i v = _mm256_i32gather_epi32(static_cast<const int*>(samples), off, 2);
+    v = _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16); // sign extend the low half
+    return _mm256_mul_ps(_mm256_cvtepi32_ps(v), _mm256_set1_ps(1.0f / 32768));
+}
+
+// Same bit trick as Storage::fromF16
+template <>
+__attribute__((target("avx2")))
+inline __m256 gather8<SAMPLE_F16>(const void* samples, __m256i off) {
+    __m256i v = _mm256_i32gather_epi32(static_cast<const int*>(samples), off, 2);
+    __m256i magnitude = _mm256_slli_epi32(_mm256_and_si256(v, _mm256_set1_epi32(0x7fff)), 13);
+    __m256i sign = _mm256_slli_epi32(_mm256_and_si256(v, _mm256_set1_epi32(0x8000)), 16);
+    __m256 f = _mm256_mul_ps(_mm256_castsi256_ps(magnitude), _mm256_set1_ps(0x1p112f));
+    return _mm256_or_ps(f, _mm256_castsi256_ps(sign));
+}
+
+template <int S>
+__attribute__((target("avx2")))
+static void renderAVX2(GrainPool& g, int nGrains, float* out, int nFrames) {
+    const int ch = g.data->nChannels;
+    const void* samples = g.data->raw();
+    const float* tables = Window::tables();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256i vch = _mm256_set1_epi32(ch);
+    const __m256i right = _mm256_set1_epi32(ch > 1 ? 1 : 0);
+    const __m256i fracMask = _mm256_set1_epi32((1u << WINDOW_FRAC_BITS) - 1);
+    const __m256 fracScale = _mm256_set1_ps(1.0f / (1u << WINDOW_FRAC_BITS));
+    for (int k = 0; k < nGrains; k += 8) {
+        __m256i alive = _mm256_loadu_si256((const __m256i*)&g.playing[k]);
+        if (_mm256_testz_si256(alive, alive))
+            continue;
+        const __m256i start = _mm256_loadu_si256((const __m256i*)&g.start[k]);
+        const __m256i window = _mm256_loadu_si256((const __m256i*)&g.window[k]);
+        const __m256i phaseInc = _mm256_loadu_si256((const __m256i*)&g.phaseInc[k]);
+        const __m256 interval = _mm256_loadu_ps(&g.interval[k]);
+        const __m256 origin = _mm256_loadu_ps(&g.origin[k]);
+        const __m256 span = _mm256_loadu_ps(&g.span[k]);
+        const __m256 panR = _mm256_loadu_ps(&g.pan[k]);
+        const __m256 panL = _mm256_sub_ps(one, panR);
+        __m256i remaining = _mm256_loadu_si256((const __m256i*)&g.remaining[k]);
+        __m256i phase = _mm256_loadu_si256((const __m256i*)&g.phase[k]);
+        const __m256i played = _mm256_loadu_si256((const __m256i*)&g.played[k]);
+        __m256 count = _mm256_cvtepi32_ps(played);
+        int i = 0;
+        for (; i < nFrames; i++) {
+            alive = _mm256_and_si256(alive, _mm256_cmpgt_epi32(remaining, _mm256_setzero_si256()));
+            if (_mm256_testz_si256(alive, alive))
+                break;
+            // same position and clamp as the scalar kernel
+            __m256 index = _mm256_add_ps(origin, _mm256_mul_ps(count, interval));
+            index = _mm256_min_ps(_mm256_max_ps(index, _mm256_setzero_ps()), span);
+            __m256i i0 = _mm256_cvttps_epi32(index);
+            __m256 t = _mm256_sub_ps(index, _mm256_cvtepi32_ps(i0));
+            // finished lanes read frame 0 so every tap stays inside the buffer
+            __m256i frame = _mm256_and_si256(_mm256_add_epi32(start, i0), alive);
+            __m256i off = _mm256_mullo_epi32(frame, vch);
+            __m256i w = _mm256_add_epi32(window, _mm256_srli_epi32(phase, WINDOW_FRAC_BITS));
+            __m256 wt = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(phase, fracMask)), fracScale);
+            __m256 w0 = _mm256_i32gather_ps(tables, w, 4);
+            __m256 w1 = _mm256_i32gather_ps(tables + 1, w, 4);
+            __m256 env = _mm256_add_ps(w0, _mm256_mul_ps(wt, _mm256_sub_ps(w1, w0)));
+            env = _mm256_and_ps(env, _mm256_castsi256_ps(alive));
+            __m256 l = interpolate8(
+                gather8<S>(samples, _mm256_sub_epi32(off, vch)),
+                gather8<S>(samples, off),
+                gather8<S>(samples, _mm256_add_epi32(off, vch)),
+                gather8<S>(samples, _mm256_add_epi32(off, _mm256_add_epi32(vch, vch))), t);
+            off = _mm256_add_epi32(off, right);
+            __m256 r = interpolate8(
+                gather8<S>(samples, _mm256_sub_epi32(off, vch)),
+                gather8<S>(samples, off),
+                gather8<S>(samples, _mm256_add_epi32(off, vch)),
+                gather8<S>(samples, _mm256_add_epi32(off, _mm256_add_epi32(vch, vch))), t);
+            l = _mm256_mul_ps(_mm256_mul_ps(l, env), panL);
+            r = _mm256_mul_ps(_mm256_mul_ps(r, env), panR);
+            // sum the lanes into [l, r, ., .]
+            __m256 h = _mm256_hadd_ps(l, r);
+            h = _mm256_hadd_ps(h, h);
+            __m128 s = _mm_add_ps(_mm256_castps256_ps128(h), _mm256_extractf128_ps(h, 1));
+            __m128 o = _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)(out + i * 2));
+            _mm_storel_pi((__m64*)(out + i * 2), _mm_add_ps(o, s));
+            count = _mm256_add_ps(count, one);
+            phase = _mm256_add_epi32(phase, phaseInc);
+            remaining = _mm256_add_epi32(remaining, alive); // alive lanes are -1
+        }
+        alive = _mm256_and_si256(alive, _mm256_cmpgt_epi32(remaining, _mm256_setzero_si256()));
+        // lanes that ended count on past their end, but are freed
+        _mm256_storeu_si256((__m256i*)&g.played[k], _mm256_add_epi32(played, _mm256_set1_epi32(i)));
+        _mm256_storeu_si256((__m256i*)&g.phase[k], phase);
+        _mm256_storeu_si256((__m256i*)&g.remaining[k], remaining);
+        _mm256_storeu_si256((__m256i*)&g.playing[k], alive);
+    }
+}
+#endif // KERNELS_X86
+
+// -- Runtime dispatch --
+typedef void (*RenderFn)(GrainPool&, int, float*, int);
+
+struct Kernel {
+    const char* name;
+    RenderFn fn[SAMPLE_STORAGES]; // per storage format
+    bool (*supported)();
+};
+
+static bool always() { return true; }
+#ifdef KERNELS_X86
+static bool hasSSE2() { return __builtin_cpu_supports("sse2"); }
+static bool hasAVX2() { return __builtin_cpu_supports("avx2"); }
+#endif
+
+// In order of preference
+static const Kernel kernels[] = {
+#ifdef KERNELS_X86
+    {"avx2", {renderAVX2<SAMPLE_F32>, renderAVX2<SAMPLE_S16>, renderAVX2<SAMPLE_F16>}, hasAVX2},
+    {"sse2", {renderSSE2<SAMPLE_F32>, renderSSE2<SAMPLE_S16>, renderSSE2<SAMPLE_F16>}, hasSSE2},
+#endif
+    {"scalar", {renderScalar<SAMPLE_F32>, renderScalar<SAMPLE_S16>, renderScalar<SAMPLE_F16>}, always},
+};
+
+static const Kernel* pickKernel() {
+#ifdef KERNELS_X86
+    __builtin_cpu_init(); // may run before the constructors that set it up
+#endif
+    const char* forced = std::getenv("GLAIVE_KERNEL");
+    for (const Kernel& k : kernels) {
+        if (forced && std::strcmp(forced, k.name) != 0)
+            continue;
+        if (k.supported())
+            return &k;
+    }
+    if (forced)
+        std::cerr << "Kernel " << forced << " unavailable, using default" << std::endl;
+    for (const Kernel& k : kernels) {
+        if (k.supported())
+            return &k;
+    }
+    return &kernels[sizeof(kernels) / sizeof(Kernel) - 1];
+}
+
+static const Kernel* current = pickKernel();
+
+void Kernels::renderGrains(GrainPool& pool, int nGrains, float* out, int nFrames) {
+    current->fn[pool.data->storage](pool, nGrains, out, nFrames);
+}
+
+const char* Kernels::selected() {
+    return current->name;
+}
+
+bool Kernels::select(const char* name) {
+    for (const Kernel& k : kernels) {
+        if (std::strcmp(name, k.name) == 0 && k.supported()) {
+            current = &k;
+            return true;
+        }
+    }
+    return false;
+}
@@ -22,6 +22,7 @@ namespace fs = std::filesystem;
 #include <SDL2/SDL_opengl.h>
 #endif
 
+// Rate of the output when the device doesn't report one
 #define SAMPLE_RATE (44100)
 
 static int paErrorHandling(PaError err);
@@ -154,10 +155,13 @@ int main(int, char**)
     ScopedPaHandler paInit;
     if(paInit.result() != paNoError) return paErrorHandling(paInit.result());
 
-    AudioFileData emptyBuffer(std::vector<float>(44100, 0.0f)); // 1 second of silence at 44.1 kHz, 1 channel
-
-    AudioEngine audioEngine(SAMPLE_RATE, emptyBuffer);
-    openAudio(Pa_GetDefaultOutputDevice(), audioEngine);
+    // the engine runs at the device's own rate, files are converted to it as
+    // they load
+    PaDeviceIndex device = Pa_GetDefaultOutputDevice();
+    const PaDeviceInfo* deviceInfo = device != paNoDevice ? Pa_GetDeviceInfo(device) : nullptr;
+    AudioEngine audioEngine(deviceInfo && deviceInfo->defaultSampleRate > 0 
+        ? static_cast<int>(deviceInfo->defaultSampleRate) : SAMPLE_RATE);
+    openAudio(device, audioEngine);
     std::cout << std::endl; // because Pa_GetDefaultOutputDevice() logs without endl
     startAudio();
 
@@ -180,26 +184,26 @@ int main(int, char**)
 
                 std::string ext = fs::path(pathStr).extension().string();
                 if (ext == ".wav" || ext == ".mp3" || ext == ".flac") {
-                    if (audioEngine.granularPlaying.load()) {
-                        audioEngine.granularPlaying.store(false);
-                    }
-
                     FileManager::loading = true;
-                    FileManager::fileLoaded = false;
                     FileManager::currentFileName = fs::path(pathStr).filename().string();
 
-                    // Launch background thread to load audio
-                    std::thread([&, pathStr]() {
-                        audioEngine.audioData = FileManager::LoadAudioFile(pathStr);
-
-                        std::cout << "Audio file loaded!" << std::endl
-                                << "\tFile name: " << FileManager::currentFileName << std::endl
-                                << "\tSample rate: " << audioEngine.audioData.sampleRate << std::endl
-                                << "\tChannels: " << audioEngine.audioData.nChannels << std::endl
-                                << "\tSize (in samples): " << audioEngine.audioData.size << std::endl;
-
-                        audioEngine.granEng = GranularEngine(audioEngine.audioData);
-                        FileManager::fileLoaded = true;
+                    // Launch background thread to load audio, playback carries
+                    // on with the current sample until the new one is ready
+                    std::thread([&, pathStr, storage = FileManager::sampleStorage]() {
+                        // the sample starts playing after its first chunk,
+                        // the rest decodes while it plays
+                        auto data = FileManager::LoadAudioFile(pathStr,
+                            [&](std::shared_ptr<const AudioFileData> start) {
+                                audioEngine.loadSample(start);
+                                FileManager::fileLoaded = true;
+                            }, storage, audioEngine.sampleRate);
+                        if (data) {
+                            std::cout << "Audio file loaded!" << std::endl
+                                    << "\tFile name: " << pathStr << std::endl
+                                    << "\tSample rate: " << data->sampleRate << std::endl
+                                    << "\tChannels: " << data->nChannels << std::endl
+                                    << "\tSize (in samples): " << data->size << std::endl;
+                        }
                         FileManager::loading = false;
                     }).detach(); // fire and forget
                 } else {
@@ -207,6 +211,9 @@ int main(int, char**)
                 }
             }
         }
+        // free samples the audio thread is done with
+        audioEngine.collectSamples();
+
         if (SDL_GetWindowFlags(window) & SDL_WINDOW_MINIMIZED)
         {
             SDL_Delay(10);
@@ -0,0 +1,185 @@
+/* midi.cpp
+Standard MIDI File parsing */
+
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+
+#include "midi.h"
+
+// Event of any track in ticks, before tempo is applied
+struct TickEvent {
+    unsigned long tick;
+    int order; // file order, keeps simultaneous events stable
+    bool tempo;
+    int value; // microseconds per quarter note for tempo, else the note
+    float velocity;
+};
+
+// Big endian reader that fails instead of running past the end
+struct Reader {
+    const unsigned char* p;
+    const unsigned char* end;
+    bool ok = true;
+
+    int byte() {
+        if (p >= end) {
+            ok = false;
+            return 0;
+        }
+        return *p++;
+    }
+    unsigned long number(int bytes) {
+        unsigned long v = 0;
+        for (int i = 0; i < bytes; i++)
+            v = v << 8 | byte();
+        return v;
+    }
+    // Variable length quantity, 7 bits per byte
+    unsigned long vlq() {
+        unsigned long v = 0;
+        for (int i = 0; i < 4; i++) {
+            int b = byte();
+            v = v << 7 | (b & 0x7F);
+            if (!(b & 0x80))
+                return v;
+        }
+        ok = false;
+        return v;
+    }
+    void skip(unsigned long n) {
+        if (n > static_cast<unsigned long>(end - p)) {
+            ok = false;
+            p = end;
+        } else {
+            p += n;
+        }
+    }
+};
+
+static bool readTrack(Reader r, std::vector<TickEvent>& events) {
+    unsigned long tick = 0;
+    int status = 0;
+    while (r.ok && r.p < r.end) {
+        tick += r.vlq();
+        int b = r.byte();
+        if (b == 0xFF) { // meta event
+            status = 0; // meta and sysex events cancel running status
+            int type = r.byte();
+            unsigned long len = r.vlq();
+            if (type == 0x51 && len == 3) {
+                int usPerQuarter = r.number(3);
+                events.push_back({tick, (int)events.size(), true, usPerQuarter, 0.0f});
+            } else if (type == 0x2F) {
+                break; // end of track
+            } else {
+                r.skip(len);
+            }
+            continue;
+        }
+        if (b == 0xF0 || b == 0xF7) { // sysex
+            status = 0;
+            r.skip(r.vlq());
+            continue;
+        }
+        int data1;
+        if (b & 0x80) {
+            status = b;
+            data1 = r.byte();
+        } else if (status) { // running status
+            data1 = b;
+        } else {
+            return false;
+        }
+        int type = status & 0xF0;
+        if (type == 0xC0 || type == 0xD0)
+            continue; // one data byte
+        int data2 = r.byte();
+        if (type == 0x90 && data2 > 0)
+            events.push_back({tick, (int)events.size(), false, data1, data2 / 127.0f});
+        else if (type == 0x80 || type == 0x90)
+            events.push_back({tick, (int)events.size(), false, data1, 0.0f});
+    }
+    return r.ok;
+}
+
+bool Midi::LoadMidiFile(const std::string& filename, std::vector<MidiNote>& notes) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) {
+        std::cerr << "Failed to open MIDI file: " << filename << std::endl;
+        return false;
+    }
+    std::vector<unsigned char> bytes((std::istreambuf_iterator<char>(file)), 
+        std::istreambuf_iterator<char>());
+    Reader r = {bytes.data(), bytes.data() + bytes.size()};
+
+    if (r.number(4) != 0x4D546864 || r.number(4) < 6) { // "MThd"
+        std::cerr << "Not a Standard MIDI File: " << filename << std::endl;
+        return false;
+    }
+    int format = r.number(2);
+    int nTracks = r.number(2);
+    int division = r.number(2);
+    if (!r.ok) {
+        std::cerr << "Truncated MIDI file: " << filename << std::endl;
+        return false;
+    }
+    if (format > 1 || division == 0) {
+        std::cerr << "Unsupported MIDI file (format " << format << "): " << filename << std::endl;
+        return false;
+    }
+    // SMPTE timing needs frames per second and ticks per frame
+    if ((division & 0x8000) && (-static_cast<signed char>(division >> 8) <= 0 || (division & 0xFF) == 0)) {
+        std::cerr << "Invalid SMPTE division in MIDI file: " << filename << std::endl;
+        return false;
+    }
+
+    std::vector<TickEvent> events;
+    for (int t = 0; t < nTracks && r.ok; t++) {
+        unsigned long id = r.number(4);
+        unsigned long len = r.number(4);
+        if (!r.ok || len > static_cast<unsigned long>(r.end - r.p)) {
+            std::cerr << "Truncated MIDI file: " << filename << std::endl;
+            return false;
+        }
+        if (id == 0x4D54726B) { // "MTrk"
+            Reader track = {r.p, r.p + len};
+            if (!readTrack(track, events)) {
+                std::cerr << "Corrupt track " << t << " in MIDI file: " << filename << std::endl;
+                return false;
+            }
+        }
+        r.skip(len);
+    }
+    // tempo changes apply before notes on the same tick
+    std::sort(events.begin(), events.end(), [](const TickEvent& a, const TickEvent& b) {
+        if (a.tick != b.tick)
+            return a.tick < b.tick;
+        if (a.tempo != b.tempo)
+            return a.tempo;
+        return a.order < b.order;
+    });
+
+    notes.clear();
+    double seconds = 0.0;
+    unsigned long lastTick = 0;
+    double secondsPerTick;
+    if (division & 0x8000) { // SMPTE frames per second and ticks per frame
+        int fps = -static_cast<signed char>(division >> 8);
+        secondsPerTick = 1.0 / (fps * (division & 0xFF));
+    } else {
+        secondsPerTick = 0.5 / division; // 120 bpm until a tempo event
+    }
+    for (const TickEvent& e : events) {
+        seconds += (e.tick - lastTick) * secondsPerTick;
+        lastTick = e.tick;
+        if (e.tempo) {
+            if (!(division & 0x8000))
+                secondsPerTick = e.value / 1e6 / division;
+        } else {
+            notes.push_back({seconds, e.value, e.velocity});
+        }
+    }
+    return true;
+}
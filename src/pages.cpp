@@ -0,0 +1,157 @@
+/* pages.cpp
+Page cache that streams long files from disk around the playing positions */
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "pages.h"
+#include "filemanager.h"
+
+const int PageStore::SLOT_STRIDE = PAGE_SPAN + 2 * GUARD_FRAMES;
+
+PageStore::PageStore(std::unique_ptr<PageSource> source, float* arena, long long frames, int channels, int nSlots)
+    : source(std::move(source)), arena(arena), frames(frames),
+    nPages((frames + PAGE_FRAMES - 1) / PAGE_FRAMES), channels(channels), nSlots(nSlots),
+    table(new std::atomic<int>[nPages]), slotPage(new std::atomic<long long>[nSlots]),
+    pins(new std::atomic<int>[nSlots]), lastWanted(nSlots, -1)
+{
+    for (long long p = 0; p < nPages; p++)
+        table[p].store(-1, std::memory_order_relaxed);
+    for (int s = 0; s < nSlots; s++) {
+        slotPage[s].store(-1, std::memory_order_relaxed);
+        pins[s].store(0, std::memory_order_relaxed);
+    }
+    for (auto& c : cursors)
+        c.store(-1, std::memory_order_relaxed);
+    for (auto& m : misses)
+        m.store(-1, std::memory_order_relaxed);
+}
+
+PageStore::~PageStore() {
+    if (thread.joinable()) {
+        wake.release();
+        thread.join();
+    }
+}
+
+void PageStore::start() {
+    // every engine starts at the beginning of the file
+    cursors[0].store(0, std::memory_order_relaxed);
+    prefetch();
+    thread = std::thread([this]() { loop(); });
+}
+
+bool PageStore::pin(long long frame, double span, int& slotFrame) {
+    long long page = frame / PAGE_FRAMES;
+    long long offset = frame - page * PAGE_FRAMES;
+    if (page >= nPages || offset + span > PAGE_SPAN)
+        return false;
+    int slot = table[page].load();
+    if (slot >= 0) {
+        // pinned before checking the page is still there, the prefetcher
+        // unmaps a page before checking its pins, so one of the two backs off
+        pins[slot].fetch_add(1);
+        if (table[page].load() == slot) {
+            slotFrame = slot * SLOT_STRIDE + static_cast<int>(offset);
+            return true;
+        }
+        pins[slot].fetch_sub(1);
+    }
+    if (blocking.load(std::memory_order_relaxed)) {
+        {
+            std::lock_guard<std::mutex> lock(loadMutex);
+            // a pass of its own, any page not pinned can make room
+            pass++;
+            if (table[page].load() < 0 && !load(page))
+                return false;
+        }
+        return pin(frame, span, slotFrame);
+    }
+    misses[nextMiss.fetch_add(1, std::memory_order_relaxed) % PAGE_MISSES]
+        .store(page, std::memory_order_relaxed);
+    return false;
+}
+
+void PageStore::unpin(int slotFrame) {
+    pins[slotFrame / SLOT_STRIDE].fetch_sub(1, std::memory_order_release);
+}
+
+void PageStore::loop() {
+    while (!wake.try_acquire_for(std::chrono::milliseconds(PREFETCH_INTERVAL_MS)))
+        prefetch();
+}
+
+void PageStore::prefetch() {
+    std::lock_guard<std::mutex> lock(loadMutex);
+    pass++;
+    // misses first, a grain is waiting on them, then the pages ahead of
+    // every cursor
+    std::vector<long long> wanted;
+    for (auto& m : misses) {
+        long long page = m.exchange(-1, std::memory_order_relaxed);
+        if (page >= 0)
+            wanted.push_back(page);
+    }
+    for (int i = 0; i < PREFETCH_PAGES + 1; i++) {
+        for (auto& c : cursors) {
+            long long frame = c.load(std::memory_order_relaxed);
+            if (frame >= 0)
+                wanted.push_back(std::min(frame / PAGE_FRAMES + i, nPages - 1));
+        }
+    }
+    // mark everything wanted first so no wanted page gets evicted for another
+    for (long long page : wanted) {
+        int slot = table[page].load(std::memory_order_relaxed);
+        if (slot >= 0)
+            lastWanted[slot] = pass;
+    }
+    for (long long page : wanted) {
+        if (table[page].load(std::memory_order_relaxed) < 0 && !load(page))
+            break;
+    }
+}
+
+bool PageStore::load(long long page) {
+    int slot = -1;
+    for (int s = 0; s < nSlots && slot < 0; s++) {
+        if (slotPage[s].load(std::memory_order_relaxed) < 0)
+            slot = s;
+    }
+    // evict the least recently wanted page nobody reads
+    std::vector<bool> tried(nSlots, false);
+    while (slot < 0) {
+        int lru = -1;
+        for (int s = 0; s < nSlots; s++) {
+            if (!tried[s] && lastWanted[s] < pass && (lru < 0 || lastWanted[s] < lastWanted[lru]))
+                lru = s;
+        }
+        if (lru < 0)
+            return false;
+        tried[lru] = true;
+        long long old = slotPage[lru].load(std::memory_order_relaxed);
+        table[old].store(-1);
+        if (pins[lru].load() != 0) {
+            table[old].store(lru);
+            continue;
+        }
+        slotPage[lru].store(-1, std::memory_order_relaxed);
+        slot = lru;
+    }
+
+    // the slot holds the page and the guard frames around it, silent past
+    // either end of the file
+    float* out = arena + static_cast<size_t>(slot) * SLOT_STRIDE * channels;
+    std::fill(out, out + static_cast<size_t>(SLOT_STRIDE) * channels, 0.0f);
+    long long first = page * PAGE_FRAMES - GUARD_FRAMES;
+    long long skip = std::max(0LL, -first);
+    long long n = std::min<long long>(SLOT_STRIDE - skip, frames - (first + skip));
+    source->read(first + skip, n, out + skip * channels);
+
+    lastWanted[slot] = pass;
+    slotPage[slot].store(page, std::memory_order_relaxed);
+    // publishes the decoded frames along with the mapping
+    table[page].store(slot);
+    loaded.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
@@ -0,0 +1,235 @@
+/* pcmcache.cpp
+Decoded PCM and peak cache, files per source keyed by its path, modification
+time and size, evicted least recently used first */
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "pcmcache.h"
+#include "storage.h"
+
+namespace fs = std::filesystem;
+
+static const char MAGIC[8] = {'G', 'L', 'V', 'P', 'C', 'M', '1', '\0'};
+static const char PEAK_MAGIC[8] = {'G', 'L', 'V', 'P', 'K', 'S', '1', '\0'};
+
+PcmCache::MappedFile::~MappedFile() {
+    if (address)
+        munmap(address, length);
+}
+
+static fs::path cacheDirectory() {
+    if (const char* xdg = getenv("XDG_CACHE_HOME"); xdg && *xdg)
+        return fs::path(xdg) / "glaive-granular";
+    const char* home = getenv("HOME");
+    if (!home || !*home)
+        return {};
+#ifdef __APPLE__
+    return fs::path(home) / "Library" / "Caches" / "glaive-granular";
+#else
+    return fs::path(home) / ".cache" / "glaive-granular";
+#endif
+}
+
+// Cache file of a source, named after a FNV-1a hash of its absolute path,
+// modification time and size so an edited file misses, and of the storage
+// for compact ones and the rate for converted ones. Empty on error
+static fs::path entryPath(const std::string& filename, int storage, int rate, const char* extension) {
+    std::error_code ec;
+    fs::path source = fs::canonical(filename, ec);
+    if (ec)
+        return {};
+    auto mtime = fs::last_write_time(source, ec).time_since_epoch().count();
+    if (ec)
+        return {};
+    auto size = fs::file_size(source, ec);
+    if (ec)
+        return {};
+    fs::path dir = cacheDirectory();
+    if (dir.empty())
+        return {};
+    std::string key = source.string() + '\0' + std::to_string(mtime) + '\0' + std::to_string(size);
+    if (storage != SAMPLE_F32)
+        key += '\0' + std::string(Storage::name(storage));
+    if (rate > 0)
+        key += '\0' + std::to_string(rate) + "Hz";
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : key) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx%s", static_cast<unsigned long long>(hash), extension);
+    return dir / name;
+}
+
+std::unique_ptr<PcmCache::MappedFile> PcmCache::Find(const std::string& filename, int guardFrames, 
+    int storage, int rate) 
+{
+    if (!enabled)
+        return nullptr;
+    fs::path entry = entryPath(filename, storage, rate, ".pcm");
+    if (entry.empty())
+        return nullptr;
+    int fd = open(entry.c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+    off_t length = lseek(fd, 0, SEEK_END);
+    void* address = length >= static_cast<off_t>(sizeof(Header))
+        ? mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (address == MAP_FAILED)
+        return nullptr;
+    std::unique_ptr<MappedFile> mapped(new MappedFile());
+    mapped->address = address;
+    mapped->length = length;
+
+    // a file cut short by a crash or written by another version is a miss
+    const Header& h = mapped->header();
+    long long expected = sizeof(Header)
+        + (h.frames + 2LL * guardFrames) * h.nChannels * static_cast<long long>(Storage::bytes(storage));
+    if (memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0 || h.guardFrames != guardFrames
+            || h.storage != storage || h.nChannels <= 0 || h.frames <= 0 || expected != length
+            || (rate > 0 && h.sampleRate != rate))
+        return nullptr;
+
+    // fault every page in now, on the loader thread
+    madvise(address, length, MADV_WILLNEED);
+    const long page = sysconf(_SC_PAGESIZE);
+    char sum = 0;
+    for (off_t i = 0; i < length; i += page)
+        sum += static_cast<const char*>(address)[i];
+    [[maybe_unused]] volatile char sink = sum;
+
+    // a hit makes the entry the most recently used
+    std::error_code ec;
+    fs::last_write_time(entry, fs::file_time_type::clock::now(), ec);
+    return mapped;
+}
+
+// Deletes the least recently used entries until the cache fits its capacity
+static void trim(const fs::path& dir) {
+    struct Entry {
+        fs::path path;
+        fs::file_time_type used;
+        uintmax_t size;
+    };
+    std::vector<Entry> entries;
+    long long total = 0;
+    std::error_code ec;
+    for (const auto& e : fs::directory_iterator(dir, ec)) {
+        if (e.path().extension() != ".pcm" && e.path().extension() != ".peaks")
+            continue;
+        Entry entry = {e.path(), e.last_write_time(ec), e.file_size(ec)};
+        if (ec)
+            continue;
+        total += entry.size;
+        entries.push_back(entry);
+    }
+    std::sort(entries.begin(), entries.end(),
+        [](const Entry& a, const Entry& b) { return a.used < b.used; });
+    for (const Entry& e : entries) {
+        if (total <= PcmCache::capacity)
+            break;
+        if (fs::remove(e.path, ec))
+            total -= e.size;
+    }
+}
+
+// Writes an entry under a name of its own and renames it into place, so
+// another instance never reads a partial one, then trims the cache
+static bool writeEntry(const fs::path& entry, const void* header, size_t headerBytes, 
+    const void* payload, long long payloadBytes) 
+{
+    std::error_code ec;
+    fs::create_directories(entry.parent_path(), ec);
+    fs::path temp = entry;
+    temp += ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream out(temp, std::ios::binary);
+        out.write(static_cast<const char*>(header), headerBytes);
+        out.write(static_cast<const char*>(payload), payloadBytes);
+        if (!out) {
+            out.close();
+            fs::remove(temp, ec);
+            std::cerr << "Failed to write cache entry: " << entry << std::endl;
+            return false;
+        }
+    }
+    fs::rename(temp, entry, ec);
+    if (ec) {
+        fs::remove(temp, ec);
+        return false;
+    }
+    trim(entry.parent_path());
+    return true;
+}
+
+bool PcmCache::Store(const std::string& filename, const void* samples, int storage, int nChannels, 
+    int sampleRate, long long frames, int guardFrames, int rate)
+{
+    if (!enabled)
+        return false;
+    long long bytes = (frames + 2LL * guardFrames) * nChannels * static_cast<long long>(Storage::bytes(storage));
+    // an entry that doesn't fit would only evict everything else
+    if (bytes + static_cast<long long>(sizeof(Header)) > capacity)
+        return false;
+    fs::path entry = entryPath(filename, storage, rate, ".pcm");
+    if (entry.empty())
+        return false;
+    Header h = {};
+    memcpy(h.magic, MAGIC, sizeof(MAGIC));
+    h.nChannels = nChannels;
+    h.sampleRate = sampleRate;
+    h.frames = frames;
+    h.guardFrames = guardFrames;
+    h.storage = storage;
+    return writeEntry(entry, &h, sizeof(h), samples, bytes);
+}
+
+bool PcmCache::FindPeaks(const std::string& filename, PeakPyramid& peaks) {
+    if (!enabled)
+        return false;
+    fs::path entry = entryPath(filename, SAMPLE_F32, 0, ".peaks");
+    if (entry.empty())
+        return false;
+    std::ifstream in(entry, std::ios::binary);
+    PeakHeader h;
+    if (!in.read(reinterpret_cast<char*>(&h), sizeof(h)))
+        return false;
+    // written for another length, layout or version of the pyramid
+    if (memcmp(h.magic, PEAK_MAGIC, sizeof(PEAK_MAGIC)) != 0 || h.frames != peaks.frames()
+            || h.nChannels != peaks.nChannels() || h.baseFrames != PEAK_BASE_FRAMES
+            || h.count != static_cast<int64_t>(peaks.all().size()))
+        return false;
+    std::vector<Peak> saved(h.count);
+    if (!in.read(reinterpret_cast<char*>(saved.data()), h.count * sizeof(Peak)) || !peaks.restore(std::move(saved)))
+        return false;
+    std::error_code ec;
+    fs::last_write_time(entry, fs::file_time_type::clock::now(), ec);
+    return true;
+}
+
+bool PcmCache::StorePeaks(const std::string& filename, const PeakPyramid& peaks) {
+    if (!enabled || peaks.built() < peaks.frames())
+        return false;
+    fs::path entry = entryPath(filename, SAMPLE_F32, 0, ".peaks");
+    if (entry.empty())
+        return false;
+    PeakHeader h = {};
+    memcpy(h.magic, PEAK_MAGIC, sizeof(PEAK_MAGIC));
+    h.frames = peaks.frames();
+    h.nChannels = peaks.nChannels();
+    h.baseFrames = PEAK_BASE_FRAMES;
+    h.count = peaks.all().size();
+    return writeEntry(entry, &h, sizeof(h), peaks.all().data(), h.count * sizeof(Peak));
+}
@@ -0,0 +1,79 @@
+/* peaks.cpp
+Min/max peak pyramid for the waveform display */
+
+#include <algorithm>
+
+#include "peaks.h"
+
+PeakPyramid::PeakPyramid(long long frames, int channels) : totalFrames(frames), channels(channels) {
+    // halves down to a single peak for the whole file
+    long long n = std::max(1LL, (frames + PEAK_BASE_FRAMES - 1) / PEAK_BASE_FRAMES);
+    long long offset = 0;
+    while (true) {
+        offsets.push_back(offset);
+        counts.push_back(n);
+        offset += n;
+        if (n == 1)
+            break;
+        n = (n + 1) / 2;
+    }
+    peaks.resize(offset);
+}
+
+void PeakPyramid::add(const float* samples, long long n) {
+    n = std::min(n, totalFrames - added);
+    for (long long f = 0; f < n; f++) {
+        for (int c = 0; c < channels; c++) {
+            float s = samples[f * channels + c];
+            pending.min = std::min(pending.min, s);
+            pending.max = std::max(pending.max, s);
+        }
+        added++;
+        if (added % PEAK_BASE_FRAMES != 0 && added != totalFrames)
+            continue;
+        // a finest peak is done, every peak above it takes it in
+        long long i = (added - 1) / PEAK_BASE_FRAMES;
+        peaks[i] = pending;
+        pending = Peak();
+        for (int level = 1; level < levels(); level++) {
+            i /= 2;
+            const Peak* children = &peaks[offsets[level - 1] + 2 * i];
+            Peak p = children[0];
+            if (2 * i + 1 < counts[level - 1])
+                p.merge(children[1]);
+            peaks[offsets[level] + i] = p;
+        }
+    }
+    framesBuilt.store(added == totalFrames ? added : added / PEAK_BASE_FRAMES * PEAK_BASE_FRAMES, 
+        std::memory_order_release);
+}
+
+bool PeakPyramid::restore(std::vector<Peak>&& saved) {
+    if (saved.size() != peaks.size())
+        return false;
+    peaks = std::move(saved);
+    added = totalFrames;
+    framesBuilt.store(totalFrames, std::memory_order_release);
+    return true;
+}
+
+Peak PeakPyramid::range(long long first, long long last) const {
+    const long long builtFrames = built();
+    last = std::min(last, builtFrames);
+    Peak p;
+    long long f = std::max(0LL, first);
+    while (f < last) {
+        // the coarsest final peak starting at f that doesn't reach past last
+        int level = 0;
+        while (level + 1 < levels()) {
+            long long span = PEAK_BASE_FRAMES * (2LL << level);
+            if (f % span != 0 || f + span > last || !isFinal(level + 1, f / span, builtFrames))
+                break;
+            level++;
+        }
+        long long span = PEAK_BASE_FRAMES * (1LL << level);
+        p.merge(peaks[offsets[level] + f / span]);
+        f = (f / span + 1) * span;
+    }
+    return p;
+}
@@ -0,0 +1,100 @@
+/* profiler.cpp
+Audio block timing, DSP load histogram and device xrun counts */
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+
+#include "profiler.h"
+
+// Single writer, so counters are updated with plain loads and stores
+static inline void bump(std::atomic<long long>& counter, long long n = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+void Profiler::end(unsigned long nFrames, int sampleRate, bool underflow, bool overflow,
+    double latencySeconds)
+{
+    long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - started).count();
+    long long deadline = static_cast<long long>(1e9 * nFrames / sampleRate);
+    float blockLoad = deadline > 0 ? 1.0f * ns / deadline : 0.0f;
+
+    bump(blocks);
+    bump(busyNs, ns);
+    bump(deadlineNs, deadline);
+    bump(histogram[std::min(static_cast<int>(blockLoad * 100), PROFILE_BUCKETS - 1)]);
+    if (ns > deadline)
+        bump(late);
+    if (underflow)
+        bump(underflows);
+    if (overflow)
+        bump(overflows);
+    if (ns > maxNs.load(std::memory_order_relaxed))
+        maxNs.store(ns, std::memory_order_relaxed);
+    if (blockLoad > maxLoad.load(std::memory_order_relaxed))
+        maxLoad.store(blockLoad, std::memory_order_relaxed);
+    float smoothed = load.load(std::memory_order_relaxed);
+    load.store(smoothed + PROFILE_SMOOTHING * (blockLoad - smoothed), std::memory_order_relaxed);
+    latency.store(latencySeconds, std::memory_order_relaxed);
+}
+
+void Profiler::clear() {
+    for (auto& b : histogram)
+        b.store(0, std::memory_order_relaxed);
+    for (auto* counter : {&blocks, &late, &underflows, &overflows, &busyNs, &deadlineNs, &maxNs})
+        counter->store(0, std::memory_order_relaxed);
+    load.store(0.0f, std::memory_order_relaxed);
+    maxLoad.store(0.0f, std::memory_order_relaxed);
+}
+
+float Profiler::percentile(long long total, double fraction) const {
+    long long seen = 0;
+    for (int b = 0; b < PROFILE_BUCKETS; b++) {
+        seen += bucket(b);
+        if (seen >= fraction * total)
+            return (b + 1) / 100.0f;
+    }
+    return PROFILE_BUCKETS / 100.0f;
+}
+
+Profiler::Stats Profiler::stats() const {
+    Stats s;
+    s.blocks = blocks.load(std::memory_order_relaxed);
+    s.late = late.load(std::memory_order_relaxed);
+    s.underflows = underflows.load(std::memory_order_relaxed);
+    s.overflows = overflows.load(std::memory_order_relaxed);
+    s.load = load.load(std::memory_order_relaxed);
+    long long deadline = deadlineNs.load(std::memory_order_relaxed);
+    s.meanLoad = deadline > 0 ? 1.0f * busyNs.load(std::memory_order_relaxed) / deadline : 0.0f;
+    s.maxLoad = maxLoad.load(std::memory_order_relaxed);
+    // percentiles of the blocks counted in the histogram, which may run a
+    // few blocks ahead of s.blocks
+    long long total = 0;
+    for (int b = 0; b < PROFILE_BUCKETS; b++)
+        total += bucket(b);
+    s.p50 = total > 0 ? percentile(total, 0.5) : 0.0f;
+    s.p99 = total > 0 ? percentile(total, 0.99) : 0.0f;
+    s.p999 = total > 0 ? percentile(total, 0.999) : 0.0f;
+    s.maxMicroseconds = maxNs.load(std::memory_order_relaxed) / 1e3;
+    s.latencyMs = latency.load(std::memory_order_relaxed) * 1e3;
+    return s;
+}
+
+bool Profiler::dump(const std::string& path) const {
+    std::ofstream out(path);
+    Stats s = stats();
+    out << "# blocks " << s.blocks << ", late " << s.late
+        << ", underflows " << s.underflows << ", overflows " << s.overflows << "\n"
+        << "# DSP load mean " << s.meanLoad * 100 << "%, p50 " << s.p50 * 100 << "%, p99 "
+        << s.p99 * 100 << "%, p99.9 " << s.p999 * 100 << "%, max " << s.maxLoad * 100 << "%\n"
+        << "# longest block " << s.maxMicroseconds << " us, output latency " << s.latencyMs << " ms\n"
+        << "load_percent,blocks\n";
+    for (int b = 0; b < PROFILE_BUCKETS; b++)
+        out << b << "," << bucket(b) << "\n";
+    if (!out) {
+        std::cerr << "Failed to write profile: " << path << std::endl;
+        return false;
+    }
+    return true;
+}
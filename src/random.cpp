@@ -0,0 +1,109 @@
+/* random.cpp
+Random number generator seeding, block and normal draws */
+
+#include <cmath>
+
+#include "random.h"
+
+// Ziggurat of Marsaglia and Tsang for the normal distribution, 128 layers
+// of equal area. Layer i covers |x| < x[i], nearly every draw lands inside
+// the rectangle of its layer and needs no more than a compare
+#define ZIGGURAT_LAYERS (128)
+// Start of the tail, and the area of each layer
+#define ZIGGURAT_R (3.442619855899)
+#define ZIGGURAT_AREA (9.91256303526217e-3)
+
+struct ZigguratTables {
+    uint32_t k[ZIGGURAT_LAYERS]; // draws below k[i] fall inside layer i's rectangle
+    float w[ZIGGURAT_LAYERS]; // x per unit of a 32-bit draw
+    float f[ZIGGURAT_LAYERS]; // density at the outer edge of each layer
+    ZigguratTables() {
+        const double m = 0x1p32;
+        double x = ZIGGURAT_R, previous = ZIGGURAT_R;
+        const double q = ZIGGURAT_AREA / exp(-0.5 * x * x);
+        // the base layer holds the tail, as a rectangle of the same area
+        k[0] = static_cast<uint32_t>(x / q * m);
+        k[1] = 0;
+        w[0] = q / m;
+        w[ZIGGURAT_LAYERS - 1] = x / m;
+        f[0] = 1.0f;
+        f[ZIGGURAT_LAYERS - 1] = exp(-0.5 * x * x);
+        for (int i = ZIGGURAT_LAYERS - 2; i >= 1; i--) {
+            x = sqrt(-2.0 * log(ZIGGURAT_AREA / x + exp(-0.5 * x * x)));
+            k[i + 1] = static_cast<uint32_t>(x / previous * m);
+            previous = x;
+            f[i] = exp(-0.5 * x * x);
+            w[i] = x / m;
+        }
+    }
+};
+
+static const ZigguratTables& ziggurat() {
+    static const ZigguratTables t;
+    return t;
+}
+
+void Random::seed(uint64_t seed) {
+    for (uint64_t& word : s) {
+        uint64_t z = (seed += 0x9e3779b97f4a7c15);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        word = z ^ (z >> 31);
+    }
+}
+
+float Random::gaussian(uint32_t u, int layer, bool negative) {
+    const ZigguratTables& z = ziggurat();
+    float x = u * z.w[layer];
+    if (u < z.k[layer])
+        return negative ? -x : x;
+    if (layer == 0) {
+        // the tail beyond ZIGGURAT_R, by Marsaglia's exponential method
+        double tx, ty;
+        do {
+            tx = -log(1.0 - uniformDouble()) / ZIGGURAT_R;
+            ty = -log(1.0 - uniformDouble());
+        } while (ty + ty < tx * tx);
+        x = ZIGGURAT_R + tx;
+        return negative ? -x : x;
+    }
+    // in the wedge between the rectangle and the curve
+    if (z.f[layer] + uniform() * (z.f[layer - 1] - z.f[layer]) < exp(-0.5f * x * x))
+        return negative ? -x : x;
+    // rejected, start over
+    return gaussian();
+}
+
+float Random::gaussian() {
+    // the layer and the sign come from the low bits, the magnitude from the
+    // high ones, so they are independent
+    uint64_t bits = next();
+    return gaussian(bits >> 32, bits & (ZIGGURAT_LAYERS - 1), bits & ZIGGURAT_LAYERS);
+}
+
+void Random::uniform(float* out, size_t n) {
+    // two floats from each output, its top 24 bits and the 24 below them
+    size_t i = 0;
+    for (; i + 1 < n; i += 2) {
+        uint64_t bits = next();
+        out[i] = (bits >> 40) * 0x1p-24f;
+        out[i + 1] = ((bits >> 16) & 0xffffff) * 0x1p-24f;
+    }
+    if (i < n)
+        out[i] = uniform();
+}
+
+void Random::gaussian(float* out, size_t n) {
+    // two draws from each output, one per 32-bit half: the low 8 bits of a
+    // half give the layer and the sign, the 24 above them the magnitude
+    size_t i = 0;
+    for (; i + 1 < n; i += 2) {
+        uint64_t bits = next();
+        for (int h = 0; h < 2; h++) {
+            uint32_t half = static_cast<uint32_t>(bits >> (32 * h));
+            out[i + h] = gaussian(half & ~0xffu, half & (ZIGGURAT_LAYERS - 1), half & ZIGGURAT_LAYERS);
+        }
+    }
+    if (i < n)
+        out[i] = gaussian();
+}
@@ -0,0 +1,364 @@
+/* render.cpp
+glaive-render, headless offline renderer. Renders the granular output for a
+source file to a WAV file as fast as the CPU allows, no audio device or display
+needed */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <chrono>
+#include <random>
+#include <cstring>
+#include <strings.h>
+#include <cstdlib>
+#include <cmath>
+#include <fstream>
+
+#include "dr_wav.h"
+
+#include "engine.h"
+#include "filemanager.h"
+#include "window.h"
+#include "midi.h"
+#include "kernels.h"
+
+// Options taking a numeric value, each sets one parameter
+struct NumericOption {
+    const char* name;
+    float* f;
+    int* i;
+    const char* help;
+};
+
+// Compares a render sample by sample with a reference render, reporting the
+// largest difference and the signal to noise ratio of the differences. A
+// tolerance of 0 only accepts identical bits. Returns false if the renders
+// differ in format or length, or by more than tolerance
+static bool compareRenders(const char* path, const char* referencePath, double tolerance) {
+    unsigned int channels, rate, refChannels, refRate;
+    drwav_uint64 frames, refFrames;
+    float* out = drwav_open_file_and_read_pcm_frames_f32(path, &channels, &rate, &frames, NULL);
+    float* ref = drwav_open_file_and_read_pcm_frames_f32(referencePath, &refChannels, &refRate, 
+        &refFrames, NULL);
+    bool match = out && ref;
+    if (!ref)
+        std::cerr << "Failed to open reference: " << referencePath << std::endl;
+    if (match && (channels != refChannels || rate != refRate || frames != refFrames)) {
+        std::cerr << "Render doesn't match the reference: " << frames << " frames of " << channels
+            << " channels at " << rate << " Hz, the reference has " << refFrames << " frames of " 
+            << refChannels << " channels at " << refRate << " Hz" << std::endl;
+        match = false;
+    }
+    if (match) {
+        double maxError = 0.0, signal = 0.0, noise = 0.0;
+        long long differing = 0, worst = 0;
+        for (drwav_uint64 i = 0; i < frames * channels; i++) {
+            double error = fabs(static_cast<double>(out[i]) - ref[i]);
+            signal += static_cast<double>(ref[i]) * ref[i];
+            noise += error * error;
+            if (memcmp(&out[i], &ref[i], sizeof(float)) != 0)
+                differing++;
+            // NaN counts as the largest error
+            if (!(error <= maxError)) {
+                maxError = error;
+                worst = i / channels;
+            }
+        }
+        match = tolerance > 0.0 ? maxError <= tolerance : differing == 0;
+        std::cout << "\tCompared with " << referencePath << ": ";
+        if (differing == 0)
+            std::cout << "identical" << std::endl;
+        else
+            std::cout << differing << " samples differ, max error " << maxError << " ("
+                << 20 * log10(maxError) << " dBFS) at frame " << worst << ", SNR "
+                << 10 * log10(signal / noise) << " dB" << std::endl;
+        if (!match && tolerance > 0.0)
+            std::cerr << "Render differs from the reference by more than " << tolerance << std::endl;
+        else if (!match)
+            std::cerr << "Render is not bit-exact with the reference" << std::endl;
+    }
+    drwav_free(out, NULL);
+    drwav_free(ref, NULL);
+    return match;
+}
+
+static void printUsage(const std::vector<NumericOption>& options) {
+    std::cerr << "Usage: glaive-render <input> <output.wav> [options]\n"
+        << "  --duration <s>      length of the render in seconds (default 10)\n"
+        << "  --window <name>     grain window: ";
+    for (int w = 0; w < WINDOW_SHAPES; w++)
+        std::cerr << Window::name(w) << (w + 1 < WINDOW_SHAPES ? ", " : "\n");
+    for (const NumericOption& o : options)
+        std::cerr << "  --" << o.name << std::string(18 - strlen(o.name), ' ') << o.help << "\n";
+    std::cerr << "  --no-loop           stop at the end point instead of looping\n"
+        << "  --no-cache          decode FLAC and MP3 files even if they are in the PCM cache\n"
+        << "  --block <frames>    frames per processBlock call (default 256)\n"
+        << "  --memory <MB>       files decoding to more stream from disk through a page\n"
+        << "                      cache of this size (default " << (SAMPLE_MEMORY_BUDGET >> 20) << ")\n"
+        << "  --sample-rate <Hz>  render at this sample rate, converting the input to it\n"
+        << "                      (default: the rate of the input)\n"
+        << "  --storage <format>  keep samples as f32, s16 or f16 (default f32), s16 and\n"
+        << "                      f16 take half the memory\n"
+        << "  --profile <file>    write the time taken by every block against its\n"
+        << "                      realtime deadline to a file, as a DSP load histogram\n"
+        << "  --kernel <name>     force a render kernel: avx2, sse2 or scalar\n"
+        << "  --compare <ref.wav> compare the render with a reference render, failing if\n"
+        << "                      they differ by more than --tolerance\n"
+        << "  --tolerance <x>     largest sample difference --compare accepts (default 0,\n"
+        << "                      bit-exact). Kernels differ from each other by up to\n"
+        << "                      about 1.2e-7, 1e-6 accepts renders with any kernel\n"
+        << "  --grain-log <file>  write every grain the transport starts to a CSV file\n"
+        << "  --seed <n>          random seed, renders are repeatable for a given seed\n"
+        << "  --notes <n,n,...>   play these notes on voices instead of the transport\n"
+        << "  --midi <file.mid>   play the notes of a MIDI file on voices instead of the\n"
+        << "                      transport, duration defaults to the length of the file\n";
+}
+
+int main(int argc, char** argv) {
+    AudioParams params;
+    params.loop = true;
+    GranularParams& gran = params.granular;
+    float duration = 10.0f;
+    bool durationSet = false;
+    std::vector<Midi::MidiNote> midiNotes;
+    bool midi = false;
+    int blockSize = 256;
+    int poolSize = GRAIN_POOL_SIZE;
+    int nVoices = MAX_VOICES;
+    int nWorkers = -1;
+    std::vector<int> notes;
+    unsigned int seed = std::random_device{}();
+    int storage = SAMPLE_F32;
+    int sampleRate = 0; // of the render, 0 keeps the input's
+    const char* profile = nullptr;
+    const char* reference = nullptr;
+    double tolerance = 0.0;
+    std::ofstream grainLog;
+
+    std::vector<NumericOption> options = {
+        {"hopsize", nullptr, &gran.Ha, "analysis hopsize in frames"},
+        {"density", nullptr, &gran.density, "grains per hopsize"},
+        {"rate", &gran.rate, nullptr, "grains per second, replaces density when above 0"},
+        {"pool", nullptr, &poolSize, "number of grains that can play at once per voice"},
+        {"voices", nullptr, &nVoices, "number of voices for --notes"},
+        {"workers", nullptr, &nWorkers, "threads rendering voices besides the main one"},
+        {"stretch", &gran.stretch, nullptr, "playback duration factor"},
+        {"size", &gran.size, nullptr, "grain size as a fraction of the hopsize"},
+        {"semitones", nullptr, &gran.semitones, "grain pitch in semitones"},
+        {"cents", nullptr, &gran.cents, "grain fine tuning in cents"},
+        {"jitter", &gran.jitterAmount, nullptr, "timing jitter [0,1]"},
+        {"pan", &gran.randomPanAmt, nullptr, "random pan amount [0,1]"},
+        {"spread", &gran.spread, nullptr, "position spread [0,1]"},
+        {"reverse", nullptr, &gran.revprob, "reverse grain probability in percent"},
+        {"start", &params.start, nullptr, "playback start point [0,1]"},
+        {"end", &params.end, nullptr, "playback end point [0,1]"},
+        {"volume", &params.volume, nullptr, "master volume"},
+    };
+
+    std::vector<const char*> positional;
+    for (int a = 1; a < argc; a++) {
+        std::string arg = argv[a];
+        if (arg.rfind("--", 0) != 0) {
+            positional.push_back(argv[a]);
+            continue;
+        }
+        std::string name = arg.substr(2);
+        if (name == "no-loop") {
+            params.loop = false;
+            continue;
+        }
+        if (name == "no-cache") {
+            PcmCache::enabled = false;
+            continue;
+        }
+        if (name == "help") {
+            printUsage(options);
+            return 0;
+        }
+        if (a + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return 1;
+        }
+        const char* value = argv[++a];
+        if (name == "duration") {
+            duration = atof(value);
+            durationSet = true;
+        } else if (name == "midi") {
+            if (!Midi::LoadMidiFile(value, midiNotes))
+                return 1;
+            midi = true;
+        } else if (name == "memory") {
+            FileManager::memoryBudget = static_cast<long long>(atof(value) * (1 << 20));
+        } else if (name == "storage") {
+            storage = Storage::find(value);
+            if (storage < 0) {
+                std::cerr << "Unknown storage: " << value << std::endl;
+                return 1;
+            }
+        } else if (name == "sample-rate") {
+            sampleRate = std::max(0, atoi(value));
+        } else if (name == "profile") {
+            profile = value;
+        } else if (name == "kernel") {
+            if (!Kernels::select(value)) {
+                std::cerr << "Kernel not available: " << value << std::endl;
+                return 1;
+            }
+        } else if (name == "compare") {
+            reference = value;
+        } else if (name == "tolerance") {
+            tolerance = std::max(0.0, atof(value));
+        } else if (name == "grain-log") {
+            grainLog.open(value);
+            if (!grainLog) {
+                std::cerr << "Failed to open grain log: " << value << std::endl;
+                return 1;
+            }
+            grainLog << "time,position,length,pitch,pan,reverse,window\n";
+        } else if (name == "block") {
+            blockSize = std::max(1, atoi(value));
+        } else if (name == "notes") {
+            for (const char* p = value; *p;) {
+                char* end;
+                notes.push_back(strtol(p, &end, 10));
+                p = *end == ',' ? end + 1 : end;
+                if (end == p && *p) {
+                    std::cerr << "Invalid note list: " << value << std::endl;
+                    return 1;
+                }
+            }
+        } else if (name == "seed") {
+            seed = strtoul(value, nullptr, 10);
+        } else if (name == "window") {
+            gran.window = -1;
+            for (int w = 0; w < WINDOW_SHAPES; w++) {
+                if (strcasecmp(value, Window::name(w)) == 0)
+                    gran.window = w;
+            }
+            if (gran.window < 0) {
+                std::cerr << "Unknown window: " << value << std::endl;
+                return 1;
+            }
+        } else {
+            auto it = std::find_if(options.begin(), options.end(),
+                [&](const NumericOption& o) { return name == o.name; });
+            if (it == options.end()) {
+                std::cerr << "Unknown option: " << arg << std::endl;
+                printUsage(options);
+                return 1;
+            }
+            if (it->f)
+                *it->f = atof(value);
+            else
+                *it->i = atoi(value);
+        }
+    }
+    if (positional.size() != 2) {
+        printUsage(options);
+        return 1;
+    }
+
+    FileManager::buildPeaks = false;
+    std::shared_ptr<const AudioFileData> data = FileManager::LoadAudioFile(positional[0], {}, storage, sampleRate);
+    if (!data)
+        return 1;
+    // offline there is time to wait for pages, so no grain is missed
+    if (data->pages)
+        data->pages->setBlocking(true);
+
+    // the engine runs on this thread, so parameters are applied directly
+    // instead of gliding in from the defaults
+    AudioEngine engine(data->sampleRate, params.volume, std::max(1, poolSize),
+        std::max(1, nVoices), nWorkers);
+    engine.params = params;
+    engine.publishParams();
+    engine.loadSample(data);
+    engine.granEng.seed(seed);
+    for (size_t v = 0; v < engine.voices.voices.size(); v++)
+        engine.voices.voices[v].engine.seed(seed + 1 + v);
+    engine.granEng.setParameters(gran, true);
+    for (int note : notes)
+        engine.sendNote(note, 1.0f);
+    engine.granularPlaying = notes.empty() && !midi;
+    // long enough for the last note to fade out
+    if (!midiNotes.empty() && !durationSet)
+        duration = midiNotes.back().seconds + params.release + 0.5f;
+
+    drwav_data_format format;
+    format.container = drwav_container_riff;
+    format.format = DR_WAVE_FORMAT_IEEE_FLOAT;
+    format.channels = 2;
+    format.sampleRate = data->sampleRate;
+    format.bitsPerSample = 32;
+    drwav wav;
+    if (!drwav_init_file_write(&wav, positional[1], &format, NULL)) {
+        std::cerr << "Failed to open output file: " << positional[1] << std::endl;
+        return 1;
+    }
+
+    const long totalFrames = static_cast<long>(duration * data->sampleRate);
+    std::vector<float> block(blockSize * 2);
+    std::chrono::duration<double> processTime(0);
+    long rendered = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    size_t nextMidi = 0;
+    // notes are picked up by the first block
+    bool first = true;
+    while (rendered < totalFrames && (first || engine.granularPlaying.load() 
+            || engine.voicesPlaying.load() > 0 || nextMidi < midiNotes.size())) {
+        first = false;
+        int n = static_cast<int>(std::min<long>(blockSize, totalFrames - rendered));
+        // queue the MIDI notes due in this block, timed to the frame
+        while (nextMidi < midiNotes.size()) {
+            const Midi::MidiNote& m = midiNotes[nextMidi];
+            long long frame = llround(m.seconds * data->sampleRate);
+            if (frame >= rendered + n || !engine.sendNote(m.note, m.velocity, frame))
+                break;
+            nextMidi++;
+        }
+        auto p0 = std::chrono::steady_clock::now();
+        engine.profiler.begin();
+        engine.processBlock(block.data(), n);
+        engine.profiler.end(n, data->sampleRate);
+        processTime += std::chrono::steady_clock::now() - p0;
+        drwav_write_pcm_frames(&wav, n, block.data());
+        rendered += n;
+        GrainEvent e;
+        while (engine.grainEvents.pop(e)) {
+            if (grainLog.is_open() && e.type == GRAIN_STARTED)
+                grainLog << e.time << "," << e.position << "," << e.length << "," << e.pitch << ","
+                    << e.pan << "," << e.reverse << "," << Window::name(e.window) << "\n";
+        }
+    }
+    drwav_uninit(&wav);
+    std::chrono::duration<double> totalTime = std::chrono::steady_clock::now() - t0;
+
+    double seconds = 1.0 * rendered / data->sampleRate;
+    std::cout << "Rendered " << seconds << " s to " << positional[1]
+        << " (seed " << seed << ")" << std::endl
+        << "\tEngine: " << processTime.count() << " s, "
+        << seconds / processTime.count() << "x realtime" << std::endl
+        << "\tTotal: " << totalTime.count() << " s, "
+        << seconds / totalTime.count() << "x realtime" << std::endl;
+    if (engine.granEng.grains.dropped > 0)
+        std::cout << "\t" << engine.granEng.grains.dropped
+            << " grains dropped, the pool was full" << std::endl;
+    if (engine.granEng.grains.missed > 0)
+        std::cout << "\t" << engine.granEng.grains.missed
+            << " grains missed, their page was still loading" << std::endl;
+    if (engine.granEng.grains.tooLong > 0)
+        std::cout << "\t" << engine.granEng.grains.tooLong
+            << " grains skipped, they read more than a page holds" << std::endl;
+    if (profile) {
+        Profiler::Stats stats = engine.profiler.stats();
+        std::cout << "\tBlocks: p99 " << stats.p99 * 100 << "% of realtime, longest "
+            << stats.maxMicroseconds << " us, " << stats.late << " over their deadline" << std::endl;
+        if (!engine.profiler.dump(profile))
+            return 1;
+    }
+    if (reference && !compareRenders(positional[1], reference, tolerance))
+        return 1;
+    return 0;
+}
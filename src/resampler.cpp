@@ -0,0 +1,226 @@
+/* resampler.cpp
+Polyphase windowed-sinc sample rate conversion. The filter is a sinc cut off
+below the Nyquist frequency of the lower rate, shaped by a Kaiser window and
+sampled at every phase an output frame can fall on between two input frames */
+
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <algorithm>
+
+#include "resampler.h"
+#include "storage.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RESAMPLER_X86
+#include <immintrin.h>
+#endif
+
+#ifndef M_PI
+#define M_PI (3.14159265)
+#endif
+
+// Modified Bessel function of the first kind, order 0, for the Kaiser window
+static double besselI0(double x) {
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; term > 1e-12 * sum; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+Resampler::Resampler(int inRate, int outRate) {
+    long long g = std::gcd(inRate, outRate);
+    L = outRate / g;
+    M = inRate / g;
+    nPhases = static_cast<int>(std::min<long long>(L, RESAMPLE_MAX_PHASES));
+    // converting down, the cutoff drops with the output rate and the filter
+    // gets longer to keep the same steepness
+    const double scale = std::min(1.0, 1.0 * outRate / inRate);
+    nTaps = static_cast<int>(ceil(RESAMPLE_TAPS / scale / 8)) * 8;
+    const int half = nTaps / 2;
+    // Kaiser's estimates of the window shape and of the transition band the
+    // taps allow, in cycles per input frame. The band ends at the Nyquist
+    // frequency of the lower rate
+    const double A = RESAMPLE_STOPBAND_DB;
+    const double beta = 0.1102 * (A - 8.7);
+    const double transition = (A - 8.0) / (2.285 * 2.0 * M_PI * (nTaps - 1));
+    const double cutoff = 0.5 * scale - 0.5 * transition;
+    const double norm = besselI0(beta);
+
+    table.resize(static_cast<size_t>(nPhases) * nTaps);
+    for (int p = 0; p < nPhases; p++) {
+        float* row = &table[static_cast<size_t>(p) * nTaps];
+        double sum = 0.0;
+        for (int t = 0; t < nTaps; t++) {
+            // distance from the output frame to the input frame of the tap
+            double x = t - (half - 1) - 1.0 * p / nPhases;
+            double y = 2.0 * cutoff * x;
+            double sinc = y == 0.0 ? 1.0 : sin(M_PI * y) / (M_PI * y);
+            double u = x / half;
+            double w = u * u < 1.0 ? besselI0(beta * sqrt(1.0 - u * u)) / norm : 0.0;
+            row[t] = static_cast<float>(sinc * w);
+            sum += row[t];
+        }
+        // unity gain at DC for every phase
+        for (int t = 0; t < nTaps; t++)
+            row[t] = static_cast<float>(row[t] / sum);
+    }
+}
+
+long long Resampler::outFrames(long long inFrames) const {
+    return inFrames > 0 ? ((inFrames - 1) * L) / M + 1 : 0;
+}
+
+const float* Resampler::coefficients(long long n) const {
+    long long phase = (n * M) % L;
+    if (nPhases < L)
+        phase = phase * nPhases / L;
+    return &table[static_cast<size_t>(phase) * nTaps];
+}
+
+// -- Dot products --
+
+static float dotScalar(const float* a, const float* b, int n) {
+    float sum = 0.0f;
+    for (int i = 0; i < n; i++)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+#ifdef RESAMPLER_X86
+__attribute__((target("sse2")))
+static float dotSSE2(const float* a, const float* b, int n) {
+    __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+    for (int i = 0; i < n; i += 8) {
+        s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    __m128 s = _mm_add_ps(s0, s1);
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+
+__attribute__((target("avx2")))
+static float dotAVX2(const float* a, const float* b, int n) {
+    __m256 s = _mm256_setzero_ps();
+    for (int i = 0; i < n; i += 8)
+        s = _mm256_add_ps(s, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+    __m128 h = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+    h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+    h = _mm_add_ss(h, _mm_shuffle_ps(h, h, 1));
+    return _mm_cvtss_f32(h);
+}
+#endif
+
+typedef float (*DotFn)(const float*, const float*, int);
+
+static DotFn pickDot() {
+#ifdef RESAMPLER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return dotAVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return dotSSE2;
+#endif
+    return dotScalar;
+}
+
+static const DotFn dotFn = pickDot();
+
+float Resampler::dot(const float* a, const float* b, int n) {
+    return dotFn(a, b, n);
+}
+
+// -- Resampled source --
+
+ResampledSource::ResampledSource(std::unique_ptr<PageSource> in,
+    std::shared_ptr<const Resampler> r, long long numFrames, int numChannels)
+    : input(std::move(in)), resampler(std::move(r)), inFrames(numFrames),
+    totalFrames(resampler->outFrames(numFrames)), channels(numChannels),
+    capacity(static_cast<long long>(ceil(RESAMPLE_BLOCK_FRAMES * resampler->ratio()))
+        + resampler->taps() + 1)
+{
+    window.resize(capacity * channels);
+    interleaved.resize(capacity * channels);
+}
+
+bool ResampledSource::fill(long long first, long long last) {
+    if (first < windowStart || first > windowEnd || failed) {
+        // a jump, the window starts over
+        windowStart = windowEnd = first;
+        failed = false;
+    } else if (first > windowStart) {
+        long long keep = windowEnd - first;
+        for (int c = 0; c < channels; c++) {
+            float* plane = &window[c * capacity];
+            memmove(plane, plane + (first - windowStart), keep * sizeof(float));
+        }
+        windowStart = first;
+    }
+    while (windowEnd < last) {
+        long long n = last - windowEnd;
+        long long got = n;
+        float* in = interleaved.data();
+        if (windowEnd < 0) {
+            got = n = std::min(n, -windowEnd);
+            std::fill(in, in + n * channels, 0.0f);
+        } else if (windowEnd >= inFrames) {
+            std::fill(in, in + n * channels, 0.0f);
+        } else {
+            n = std::min(n, inFrames - windowEnd);
+            got = input->read(windowEnd, n, in);
+        }
+        // one plane per channel
+        long long at = windowEnd - windowStart;
+        for (int c = 0; c < channels; c++) {
+            float* plane = &window[c * capacity + at];
+            for (long long i = 0; i < got; i++)
+                plane[i] = in[i * channels + c];
+        }
+        windowEnd += got;
+        if (got < n) {
+            failed = true;
+            return false;
+        }
+    }
+    return true;
+}
+
+long long ResampledSource::read(long long first, long long n, float* out) {
+    n = std::min(n, totalFrames - first);
+    const int taps = resampler->taps(), half = taps / 2;
+    long long done = 0;
+    while (done < n) {
+        const long long o = first + done;
+        long long b = std::min<long long>(RESAMPLE_BLOCK_FRAMES, n - done);
+        long long lo = resampler->center(o) - half + 1;
+        if (!fill(lo, resampler->center(o + b - 1) + half + 1)) {
+            // only the frames with every tap read
+            long long complete = 0;
+            while (complete < b && resampler->center(o + complete) + half + 1 <= windowEnd)
+                complete++;
+            b = complete;
+        }
+        for (long long j = 0; j < b; j++) {
+            const float* h = resampler->coefficients(o + j);
+            long long at = resampler->center(o + j) - half + 1 - windowStart;
+            for (int c = 0; c < channels; c++)
+                out[(done + j) * channels + c] = Resampler::dot(h, &window[c * capacity + at], taps);
+        }
+        done += b;
+        if (failed)
+            break;
+    }
+    return done;
+}
+
+long long ResampledSource::readS16(long long first, long long n, int16_t* out) {
+    converted.resize(std::max<long long>(0, n) * channels);
+    long long got = read(first, n, converted.data());
+    for (long long i = 0; i < got * channels; i++)
+        out[i] = Storage::toS16(converted[i]);
+    return got;
+}
@@ -0,0 +1,52 @@
+/* rtcheck.cpp
+Debug replacement of the global allocation functions that catches heap activity
+on the audio thread, only compiled in with RT_ALLOC_CHECK */
+
+#include "rtcheck.h"
+
+#ifdef RT_ALLOC_CHECK
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+static thread_local bool inRealtime = false;
+
+static void checkRealtime(const char* what) {
+    if (inRealtime) {
+        inRealtime = false; // let abort handlers allocate
+        fprintf(stderr, "RT_ALLOC_CHECK: %s inside the audio callback\n", what);
+        std::abort();
+    }
+}
+
+RtCheck::Scope::Scope() { inRealtime = true; }
+RtCheck::Scope::~Scope() { inRealtime = false; }
+
+void* operator new(std::size_t n) {
+    checkRealtime("operator new");
+    if (void* p = std::malloc(n ? n : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t n, std::align_val_t al) {
+    checkRealtime("operator new");
+    std::size_t align = static_cast<std::size_t>(al);
+    // aligned_alloc requires the size to be a multiple of the alignment
+    if (void* p = std::aligned_alloc(align, (n + align - 1) / align * align))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    if (p) checkRealtime("operator delete");
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+    if (p) checkRealtime("operator delete");
+    std::free(p);
+}
+
+#endif // RT_ALLOC_CHECK
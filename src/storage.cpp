@@ -0,0 +1,33 @@
+/* storage.cpp
+Sample storage formats */
+
+#include <strings.h>
+
+#include "storage.h"
+
+const char* Storage::name(int storage) {
+    static const char* names[SAMPLE_STORAGES] = {"f32", "s16", "f16"};
+    return storage >= 0 && storage < SAMPLE_STORAGES ? names[storage] : "";
+}
+
+int Storage::find(const char* name) {
+    for (int s = 0; s < SAMPLE_STORAGES; s++) {
+        if (strcasecmp(name, Storage::name(s)) == 0)
+            return s;
+    }
+    return -1;
+}
+
+void Storage::convert(const float* in, size_t n, int storage, void* out) {
+    if (storage == SAMPLE_S16) {
+        int16_t* o = static_cast<int16_t*>(out);
+        for (size_t i = 0; i < n; i++)
+            o[i] = toS16(in[i]);
+    } else if (storage == SAMPLE_F16) {
+        uint16_t* o = static_cast<uint16_t*>(out);
+        for (size_t i = 0; i < n; i++)
+            o[i] = toF16(in[i]);
+    } else {
+        memcpy(out, in, n * sizeof(float));
+    }
+}
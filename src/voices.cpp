@@ -0,0 +1,120 @@
+/* voices.cpp
+Polyphonic voice allocation, rendering and mixing */
+
+#include <algorithm>
+#include <cmath>
+
+#include "voices.h"
+#include "engine.h"
+
+Voice::Voice(int poolSize) 
+    : engine(nullptr, {}, poolSize), buffer(VOICE_CHUNK_FRAMES * 2, 0.0f) {}
+
+VoiceManager::VoiceManager(const AudioParams& p, int nVoices, int poolSize, int sr)
+    : params(p), sampleRate(sr), jobs(nVoices, 0)
+{
+    voices.reserve(nVoices);
+    for (int i = 0; i < nVoices; i++) {
+        voices.emplace_back(poolSize);
+        voices.back().engine.sampleRate = sr;
+    }
+}
+
+GranularParams VoiceManager::voiceParams(const Voice& v) const {
+    GranularParams p = params.granular;
+    p.semitones += v.note - ROOT_NOTE;
+    return p;
+}
+
+void VoiceManager::noteOn(int note, float velocity) {
+    Voice* voice = nullptr;
+    for (Voice& v : voices) {
+        if (!v.active) {
+            voice = &v;
+            break;
+        }
+    }
+    if (!voice) {
+        for (Voice& v : voices) {
+            if (v.released && (!voice || v.level < voice->level))
+                voice = &v;
+        }
+    }
+    if (!voice) {
+        voice = &voices[0];
+        for (Voice& v : voices) {
+            if (v.age < voice->age)
+                voice = &v;
+        }
+    }
+    // a stolen voice attacks from its current level, its grains play out
+    if (!voice->active) {
+        voice->engine.grains.clear();
+        voice->level = 0.0f;
+    }
+    voice->active = true;
+    voice->released = false;
+    voice->note = note;
+    voice->velocity = velocity;
+    voice->age = ++noteCount;
+    voice->engine.setParameters(voiceParams(*voice), true);
+    voice->engine.seek(0);
+}
+
+void VoiceManager::noteOff(int note) {
+    for (Voice& v : voices) {
+        if (v.active && v.note == note)
+            v.released = true;
+    }
+}
+
+void VoiceManager::updateParameters(bool changed) {
+    for (Voice& v : voices) {
+        if (!v.active)
+            continue;
+        if (changed)
+            v.engine.setParameters(voiceParams(v));
+        v.engine.smoothParameters();
+    }
+}
+
+int VoiceManager::prepare() {
+    nJobs = 0;
+    for (int i = 0; i < static_cast<int>(voices.size()); i++) {
+        if (voices[i].active)
+            jobs[nJobs++] = i;
+    }
+    nPlaying = nJobs;
+    return nJobs;
+}
+
+void VoiceManager::render(int job, int nFrames) {
+    Voice& v = voices[jobs[job]];
+    float* buf = v.buffer.data();
+    std::fill(buf, buf + nFrames * 2, 0.0f);
+    bool playing = v.engine.playRegion(buf, nFrames, params.start, params.end, params.loop);
+    // linear attack and release
+    float target = v.released ? 0.0f : 1.0f;
+    float seconds = v.released ? params.release : params.attack;
+    float step = 1.0f / std::max(1.0f, seconds * sampleRate);
+    for (int i = 0; i < nFrames; i++) {
+        v.level = v.level < target ? std::min(target, v.level + step) 
+                                   : std::max(target, v.level - step);
+        float gain = v.level * v.velocity;
+        buf[i*2] *= gain;
+        buf[i*2+1] *= gain;
+    }
+    if (!playing || (v.released && v.level == 0.0f))
+        v.active = false;
+}
+
+void VoiceManager::mix(float* out, int nFrames) {
+    for (int j = 0; j < nJobs; j++) {
+        Voice& v = voices[jobs[j]];
+        const float* buf = v.buffer.data();
+        for (int i = 0; i < nFrames * 2; i++)
+            out[i] += buf[i];
+        if (!v.active)
+            v.engine.grains.clear();
+    }
+}
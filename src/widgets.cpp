@@ -170,6 +170,41 @@ void Widgets::PlotLines(const char* label, float (*values_getter)(void* data, in
     PlotEx(ImGuiPlotType_Lines, label, values_getter, data, values_count, values_offset, overlay_text, scale_min, scale_max, graph_size);
 }
 
+// -- Waveform drawn as one min/max bar per column --
+void Widgets::PlotPeaks(const char* label, const float* mins, const float* maxs, int count, ImVec2 size)
+{
+    ImGuiWindow* window = ImGui::GetCurrentWindow();
+    if (window->SkipItems)
+        return;
+
+    ImGuiContext& g = *GImGui;
+    const ImGuiStyle& style = g.Style;
+    const ImGuiID id = window->GetID(label);
+
+    const ImRect frame_bb(window->DC.CursorPos, window->DC.CursorPos + size);
+    const ImRect inner_bb(frame_bb.Min + style.FramePadding, frame_bb.Max - style.FramePadding);
+    ImGui::ItemSize(frame_bb, style.FramePadding.y);
+    if (!ImGui::ItemAdd(frame_bb, id))
+        return;
+
+    ImGui::RenderFrame(frame_bb.Min, frame_bb.Max, ImGui::GetColorU32(ImGuiCol_FrameBg), true, style.FrameRounding);
+    if (count <= 0)
+        return;
+    const ImU32 col = ImGui::GetColorU32(ImGuiCol_PlotLines);
+    const float column = inner_bb.GetWidth() / count;
+    const float half = inner_bb.GetHeight() * 0.5f;
+    const float mid = inner_bb.Min.y + half;
+    for (int i = 0; i < count; i++) {
+        if (mins[i] > maxs[i])
+            continue;
+        // at least a pixel high, so silence still draws a line
+        float top = mid - ImClamp(maxs[i], -1.0f, 1.0f) * half;
+        float bottom = ImMax(mid - ImClamp(mins[i], -1.0f, 1.0f) * half, top + 1.0f);
+        float x = inner_bb.Min.x + i * column;
+        window->DrawList->AddRectFilled(ImVec2(x, top), ImVec2(x + ImMax(column, 1.0f), bottom), col);
+    }
+}
+
 // Checkbox that displays a rectangle instead of checkmark
 bool Widgets::Checkbox(const char* label, bool* v)
 {
@@ -0,0 +1,65 @@
+/* window.cpp
+Builds the grain window tables once, on first use */
+
+#include <cmath>
+#include <algorithm>
+
+#include "window.h"
+
+#ifndef M_PI
+#define M_PI (3.14159265)
+#endif
+
+// Window value at x ∈ [0,1]
+static double shapeAt(int shape, double x) {
+    switch (shape) {
+    case WINDOW_TUKEY: {
+        const double taper = 0.25; // fraction of the window used by each taper
+        double edge = std::min(x, 1.0 - x);
+        return edge < taper ? 0.5 - 0.5 * cos(M_PI * edge / taper) : 1.0;
+    }
+    case WINDOW_GAUSSIAN: {
+        const double sigma = 0.15;
+        // shifted and rescaled so the window starts and ends at 0
+        double edge = exp(-0.5 * (0.5 / sigma) * (0.5 / sigma));
+        double g = exp(-0.5 * ((x - 0.5) / sigma) * ((x - 0.5) / sigma));
+        return (g - edge) / (1.0 - edge);
+    }
+    case WINDOW_TRAPEZOID:
+        return std::min(1.0, std::min(x, 1.0 - x) / 0.25);
+    case WINDOW_EXPODEC: {
+        const double attack = 0.05;
+        if (x < attack)
+            return pow(sin(M_PI / 2.0 * x / attack), 2.0);
+        double d = (x - attack) / (1.0 - attack);
+        return exp(-4.0 * d) * (1.0 - d);
+    }
+    case WINDOW_REXPODEC:
+        return shapeAt(WINDOW_EXPODEC, 1.0 - x);
+    case WINDOW_HANN:
+    default:
+        return 0.5 - 0.5 * cos(2.0 * M_PI * x);
+    }
+}
+
+struct WindowTables {
+    float values[WINDOW_SHAPES * (WINDOW_TABLE_SIZE + 1)];
+    WindowTables() {
+        for (int s = 0; s < WINDOW_SHAPES; s++) {
+            for (int i = 0; i <= WINDOW_TABLE_SIZE; i++)
+                values[Window::offset(s) + i] = shapeAt(s, 1.0 * i / WINDOW_TABLE_SIZE);
+        }
+    }
+};
+
+const float* Window::tables() {
+    static const WindowTables t;
+    return t.values;
+}
+
+const char* Window::name(int shape) {
+    static const char* names[WINDOW_SHAPES] = {
+        "Hann", "Tukey", "Gaussian", "Trapezoid", "Expodec", "Rexpodec"
+    };
+    return shape >= 0 && shape < WINDOW_SHAPES ? names[shape] : "";
+}
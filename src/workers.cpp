@@ -0,0 +1,76 @@
+/* workers.cpp
+Worker threads that render in parallel with the audio thread */
+
+#include <algorithm>
+
+#include "workers.h"
+#include "rtcheck.h"
+
+// Pause hints spent waiting for workers before yielding the core
+#define SPIN_LIMIT (2000)
+
+// Tells the CPU the thread is spinning
+static inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+WorkerPool::WorkerPool(int nThreads) {
+    for (int i = 0; i < nThreads; i++) {
+        workers.push_back(std::make_unique<Worker>());
+        Worker& w = *workers.back();
+        w.thread = std::thread([this, &w]() { loop(w); });
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    quit.store(true);
+    for (auto& w : workers)
+        w->wake.release();
+    for (auto& w : workers)
+        w->thread.join();
+}
+
+void WorkerPool::run(int nJobs, Job job, void* context) {
+    if (nJobs <= 0)
+        return;
+    this->job = job;
+    this->context = context;
+    this->nJobs = nJobs;
+    next.store(0, std::memory_order_relaxed);
+    finished.store(0, std::memory_order_relaxed);
+    // the caller takes jobs too, so one job needs no worker
+    int woken = std::min(size(), nJobs - 1);
+    for (int w = 0; w < woken; w++)
+        workers[w]->wake.release();
+    work();
+    // only woken workers count, each finishes the batch exactly once. After
+    // a short spin the caller yields, in case a worker shares its core
+    for (int spins = 0; finished.load(std::memory_order_acquire) < woken; spins++) {
+        if (spins < SPIN_LIMIT)
+            cpuRelax();
+        else
+            std::this_thread::yield();
+    }
+}
+
+void WorkerPool::work() {
+    for (int i; (i = next.fetch_add(1, std::memory_order_relaxed)) < nJobs;)
+        job(context, i);
+}
+
+void WorkerPool::loop(Worker& worker) {
+    while (true) {
+        worker.wake.acquire();
+        if (quit.load())
+            return;
+        {
+            [[maybe_unused]] RtCheck::Scope rtScope; // same rules as the audio thread
+            work();
+        }
+        finished.fetch_add(1, std::memory_order_release);
+    }
+}
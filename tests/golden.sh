@@ -0,0 +1,93 @@
+#!/bin/sh
+# Golden render regression tests. Renders a matrix of fixed-seed parameter sets
+# with glaive-render and compares each with its reference in tests/golden,
+# with every render kernel the CPU supports. The references are rendered with
+# the scalar kernel, the SIMD ones round the interpolation differently by up
+# to about 1e-7, well within TOLERANCE. Run with --update to render the
+# references again after a change that is meant to alter the output. Last,
+# a paged render is checked against the same render from memory
+#
+# Usage: tests/golden.sh [--update]   (RENDER=path/to/glaive-render to override)
+
+RENDER=${RENDER:-./glaive-render}
+DIR=$(dirname "$0")/golden
+TOLERANCE=1e-6
+COMMON="--duration 0.5 --seed 1 --hopsize 1000"
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+# name, input and options of each case
+CASES="
+default       source-stereo.wav
+mono          source-mono.wav
+dense         source-stereo.wav  --density 8
+stretched     source-stereo.wav  --stretch 4 --size 0.9
+fifth-up      source-stereo.wav  --semitones 7
+octave-down   source-mono.wav    --semitones -12 --cents 30
+reverse       source-stereo.wav  --reverse 50
+reverse-mono  source-mono.wav    --reverse 100 --semitones 5 --window Expodec
+randomized    source-stereo.wav  --spread 0.5 --pan 1 --jitter 0.5 --density 4
+s16           source-stereo.wav  --storage s16 --semitones 3
+f16           source-mono.wav    --storage f16 --reverse 30
+grains-per-s  source-stereo.wav  --rate 120
+resampled     source-stereo.wav  --sample-rate 48000 --semitones 2
+"
+
+if [ ! -x "$RENDER" ]; then
+    echo "glaive-render not found at $RENDER, build it with make render" >&2
+    exit 1
+fi
+
+failed=0
+passed=0
+echo "$CASES" | while read -r name input options; do
+    [ -z "$name" ] && continue
+    if [ "$1" = "--update" ]; then
+        "$RENDER" "$DIR/$input" "$DIR/$name.wav" $COMMON $options --kernel scalar > /dev/null || exit 1
+        echo "Updated $name"
+        continue
+    fi
+    for kernel in scalar sse2 avx2; do
+        out="$OUT/$name-$kernel.wav"
+        log=$("$RENDER" "$DIR/$input" "$out" $COMMON $options --kernel $kernel \
+            --compare "$DIR/$name.wav" --tolerance $TOLERANCE 2>&1)
+        status=$?
+        # kernels the CPU lacks are skipped
+        if echo "$log" | grep -q "Kernel not available"; then
+            continue
+        fi
+        if [ $status -ne 0 ]; then
+            echo "FAILED: $name ($kernel)"
+            echo "$log" | tail -n 3
+            failed=$((failed + 1))
+        else
+            passed=$((passed + 1))
+        fi
+    done
+    echo "$passed $failed" > "$OUT/counts"
+done || exit 1
+
+[ "$1" = "--update" ] && exit 0
+read -r passed failed < "$OUT/counts"
+
+# A file over the memory budget streams through the page cache and must
+# render the same as from memory. The input is a render of its own, long
+# enough to span a few pages, read by the longest grains the knobs allow
+PAGED="--duration 4 --seed 1 --hopsize 8000 --stretch 10 --size 0.99 --semitones 24 --cents 100
+    --spread 0.3 --density 4"
+"$RENDER" "$DIR/source-mono.wav" "$OUT/long.wav" $COMMON --stretch 40 --duration 15 > /dev/null || exit 1
+"$RENDER" "$OUT/long.wav" "$OUT/memory.wav" $PAGED > /dev/null || exit 1
+log=$("$RENDER" "$OUT/long.wav" "$OUT/paged.wav" $PAGED --memory 1 \
+    --compare "$OUT/memory.wav" --tolerance $TOLERANCE 2>&1)
+if [ $? -ne 0 ] || echo "$log" | grep -q "grains missed\|grains skipped"; then
+    echo "FAILED: paged"
+    echo "$log" | tail -n 3
+    failed=$((failed + 1))
+else
+    passed=$((passed + 1))
+fi
+if [ "$failed" -ne 0 ]; then
+    echo "$failed of $((passed + failed)) golden renders differ from their reference" >&2
+    exit 1
+fi
+echo "Golden renders: $passed passed"
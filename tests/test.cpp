@@ -0,0 +1,27 @@
+/* test.cpp
+glaive-test, runs every set of checks of the audio processing */
+
+#include <iostream>
+
+#include "test.h"
+
+static int failures = 0;
+
+void check(bool ok, const std::string& what) {
+    if (!ok) {
+        std::cerr << "FAILED: " << what << std::endl;
+        failures++;
+    }
+}
+
+int main() {
+    int kernels = testKernels();
+    int random = testRandom();
+    if (failures > 0) {
+        std::cerr << failures << " checks failed" << std::endl;
+        return 1;
+    }
+    std::cout << "Kernels: " << kernels << " long grain renders passed" << std::endl
+        << "Random: " << random << " distribution checks passed" << std::endl;
+    return 0;
+}
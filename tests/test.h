@@ -0,0 +1,15 @@
+// Checks run by glaive-test
+#ifndef TEST_H
+#define TEST_H
+
+#include <string>
+
+// Reports what failed unless ok, glaive-test exits with an error after any
+// failure
+void check(bool ok, const std::string& what);
+
+// Each runs one set of checks and returns how many cases it ran
+int testKernels();
+int testRandom();
+
+#endif // TEST_H
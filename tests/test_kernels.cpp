@@ -0,0 +1,137 @@
+/* test_kernels.cpp
+Checks of the grain render kernels. Long pitched grains must read the source
+where they should until their last frame and never outside the range checked
+when they were triggered, forward and reverse, with every kernel and storage
+format. Build with `make test SANITIZE=address` to have any read outside the
+buffer reported */
+
+#include <vector>
+#include <cmath>
+
+#include "test.h"
+#include "granular.h"
+#include "kernels.h"
+#include "random.h"
+
+// Frames of the longest grain the GUI allows, Ha 8000 stretched 10 times
+#define TEST_GRAIN_FRAMES (80000)
+#define TEST_BLOCK (256)
+// Largest difference from the scalar kernel accepted of the SIMD ones, they
+// round the interpolation differently
+#define TEST_KERNEL_TOLERANCE (1e-5f)
+// Largest error of the read position worked out from the output, in frames
+#define TEST_POSITION_TOLERANCE (0.1)
+
+struct LongGrain {
+    const char* name;
+    float semitones;
+    bool reverse;
+};
+
+// Source long enough for one grain of TEST_GRAIN_FRAMES at pitch, which
+// starts at the first frame and ends on the last one it may read. The left
+// channel is a ramp, the right one constant, so the position a stereo grain
+// reads is left / right. Mono sources are noise
+static AudioFileData makeSource(int channels, float pitch, int storage) {
+    long long frames = static_cast<long long>(ceil(TEST_GRAIN_FRAMES * pitch)) + 1;
+    AudioFileData data(frames, channels, 44100, storage);
+    std::vector<float> samples(data.size);
+    Random random(1);
+    for (long long f = 0; f < frames; f++) {
+        if (channels == 2) {
+            samples[f * 2] = f / 262144.0f;
+            samples[f * 2 + 1] = 1.0f;
+        } else {
+            samples[f] = random.uniform() * 2.0f - 1.0f;
+        }
+    }
+    Storage::convert(samples.data(), samples.size(), storage, data.raw());
+    data.setReady(frames);
+    return data;
+}
+
+// Renders one grain until it ends, with the grain starting at frac and
+// elapsed as a scheduled one would
+static std::vector<float> renderGrain(const AudioFileData& source, const LongGrain& g,
+    double position, float elapsed)
+{
+    GrainPool pool(GRAIN_LANES, &source);
+    const float pitch = pow(2.0f, g.semitones / 12.0f);
+    std::vector<float> out(TEST_GRAIN_FRAMES * 2, 0.0f);
+    check(pool.trigger(position, TEST_GRAIN_FRAMES, 0.5f, pitch, g.reverse, WINDOW_TUKEY, elapsed),
+        std::string(g.name) + ": trigger");
+    for (int pos = 0; pos < TEST_GRAIN_FRAMES; pos += TEST_BLOCK)
+        pool.render(&out[pos * 2], std::min(TEST_BLOCK, TEST_GRAIN_FRAMES - pos));
+    check(pool.active == 0, std::string(g.name) + ": grain still playing after its length");
+    return out;
+}
+
+// The position every frame read, from the ramp, against the one it should
+// have read. Frames where the window is near silent are skipped
+static void checkPositions(const std::vector<float>& out, const LongGrain& g, double position,
+    float elapsed)
+{
+    const double pitch = pow(2.0f, g.semitones / 12.0f);
+    const double frac = position - floor(position);
+    double worst = 0.0;
+    for (int i = 0; i < TEST_GRAIN_FRAMES; i++) {
+        if (out[i * 2 + 1] < 1e-3f)
+            continue;
+        double read = 262144.0 * out[i * 2] / out[i * 2 + 1];
+        double expected = floor(position) + (g.reverse
+            ? frac + (TEST_GRAIN_FRAMES - elapsed - i) * pitch
+            : frac + (elapsed + i) * pitch);
+        worst = std::max(worst, fabs(read - expected));
+    }
+    check(worst < TEST_POSITION_TOLERANCE, std::string(g.name) + ": read position off by "
+        + std::to_string(worst) + " frames");
+}
+
+int testKernels() {
+    const LongGrain grains[] = {
+        {"forward, a fifth up", 7.0f, false},
+        {"reverse, a fifth up", 7.0f, true},
+        {"forward, an octave up", 12.0f, false},
+        {"reverse, an octave up", 12.0f, true},
+        {"forward, two octaves up", 24.0f, false},
+        {"reverse, two octaves up", 24.0f, true},
+        {"forward, detuned down", -5.3f, false},
+        {"reverse, detuned down", -5.3f, true},
+    };
+    const char* kernels[] = {"scalar", "sse2", "avx2"};
+    const float elapsed = 0.75f;
+    int cases = 0;
+    for (const LongGrain& g : grains) {
+        for (int storage = 0; storage < SAMPLE_STORAGES; storage++) {
+            for (int channels = 1; channels <= 2; channels++) {
+                const float pitch = pow(2.0f, g.semitones / 12.0f);
+                const AudioFileData source = makeSource(channels, pitch, storage);
+                // as far into the file as the grain fits, the last frame
+                // it reads is the last one of the file
+                const double position = source.frames - 1 - TEST_GRAIN_FRAMES * pitch;
+                std::vector<float> reference;
+                for (const char* kernel : kernels) {
+                    if (!Kernels::select(kernel))
+                        continue;
+                    const std::string name = std::string(g.name) + ", " + kernel + ", "
+                        + Storage::name(storage) + ", " + std::to_string(channels) + " ch";
+                    const LongGrain named = {name.c_str(), g.semitones, g.reverse};
+                    std::vector<float> out = renderGrain(source, named, position, elapsed);
+                    if (reference.empty()) {
+                        reference = out;
+                        if (channels == 2 && storage == SAMPLE_F32)
+                            checkPositions(out, named, position, elapsed);
+                    } else {
+                        float worst = 0.0f;
+                        for (size_t i = 0; i < out.size(); i++)
+                            worst = std::max(worst, fabsf(out[i] - reference[i]));
+                        check(worst <= TEST_KERNEL_TOLERANCE, name + ": differs from scalar by "
+                            + std::to_string(worst));
+                    }
+                    cases++;
+                }
+            }
+        }
+    }
+    return cases;
+}
@@ -0,0 +1,58 @@
+/* test_random.cpp
+Checks of the normal draws. Single and block draws must have mean 0, variance
+1 and the tails of the standard normal, including the part past the base
+layer of the ziggurat */
+
+#include <vector>
+#include <cmath>
+
+#include "test.h"
+#include "random.h"
+
+#define TEST_DRAWS (1 << 22)
+// Accepted distance of each statistic from its expected value, in standard
+// errors. The draws are seeded, so a pass is repeatable
+#define TEST_SIGMAS (5.0)
+
+// Fraction of the standard normal beyond +-x
+static double tail(double x) {
+    return erfc(x / sqrt(2.0));
+}
+
+static void checkNormal(const std::vector<float>& draws, const std::string& name) {
+    const double n = draws.size();
+    double sum = 0.0, squares = 0.0;
+    for (float x : draws) {
+        sum += x;
+        squares += 1.0 * x * x;
+    }
+    const double mean = sum / n;
+    const double variance = squares / n - mean * mean;
+    check(fabs(mean) < TEST_SIGMAS / sqrt(n), name + ": mean " + std::to_string(mean));
+    check(fabs(variance - 1.0) < TEST_SIGMAS * sqrt(2.0 / n),
+        name + ": variance " + std::to_string(variance));
+    // 4 lies past the start of the tail, ZIGGURAT_R
+    for (double x : {1.0, 2.0, 3.0, 4.0}) {
+        double beyond = 0.0;
+        for (float d : draws)
+            beyond += fabs(d) > x;
+        beyond /= n;
+        const double expected = tail(x);
+        check(fabs(beyond - expected) < TEST_SIGMAS * sqrt(expected * (1.0 - expected) / n),
+            name + ": " + std::to_string(beyond) + " of the draws beyond +-" + std::to_string(x)
+            + " instead of " + std::to_string(expected));
+    }
+}
+
+int testRandom() {
+    Random random(1);
+    std::vector<float> draws(TEST_DRAWS);
+    for (float& x : draws)
+        x = random.gaussian();
+    checkNormal(draws, "gaussian()");
+    // an odd count has the last draw made on its own
+    draws.resize(TEST_DRAWS - 1);
+    random.gaussian(draws.data(), draws.size());
+    checkNormal(draws, "gaussian(out, n)");
+    return 2;
+}